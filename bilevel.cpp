@@ -0,0 +1,140 @@
+#include <cmath>
+#include <algorithm>
+
+#include "bilevel.h"
+#include "trace.h"
+
+
+using namespace dither;
+
+bilevel_ditherer::bilevel_ditherer(yconv::image image, const colors_base colors)
+: ditherer_base(std::move(image)), _colors(colors)
+{
+	if(!suitable(_colors))
+		throw std::runtime_error("bilevel dithering needs a palette with exactly two colors");
+
+	for(int i = 0; i < 2; ++i)
+		_luminances[i] = luminance(_colors[i].r, _colors[i].g, _colors[i].b);
+}
+
+bool bilevel_ditherer::suitable(const colors_base& colors) noexcept
+{
+	return colors.size()==2;
+}
+
+float bilevel_ditherer::luminance(const float r, const float g, const float b) noexcept
+{
+	return r*0.299f + g*0.587f + b*0.114f;
+}
+
+std::vector<uint8_t> bilevel_ditherer::dither(const dither_type type, const float error_mult) const
+{
+	if(_image.bpp!=3 && _image.bpp!=4)
+		throw std::runtime_error(std::string("cant dither image with bits per pixel value: ") + std::to_string(_image.bpp));
+
+	std::vector<uint8_t> packed(row_size()*_image.height, 0);
+
+	if(type==dither_type::ordered)
+		dither_ordered(packed, error_mult);
+	else
+		dither_diffused(packed, type, error_mult);
+
+	return packed;
+}
+
+void bilevel_ditherer::dither_ordered(std::vector<uint8_t>& packed, const float error_mult) const
+{
+	const trace::scope trace_scope("bilevel dither");
+
+	const size_t row_bytes = row_size();
+	const float middle = (_luminances[0]+_luminances[1])/2;
+	const float spread = error_mult*std::abs(_luminances[1]-_luminances[0]);
+	const bool second_lighter = _luminances[1]>_luminances[0];
+
+	for(int y = 0; y < _image.height; ++y)
+	{
+		uint8_t* row = packed.data()+y*row_bytes;
+		for(int x = 0; x < _image.width; ++x)
+		{
+			const float value = luminance(_image.pixel_color(x, y, 0), _image.pixel_color(x, y, 1), _image.pixel_color(x, y, 2))
+				+ ordered_threshold(x, y)*spread;
+
+			const bool second = (value>middle)==second_lighter;
+			if(second)
+				row[x/8] |= 0x80>>(x%8);
+		}
+	}
+}
+
+void bilevel_ditherer::dither_diffused(std::vector<uint8_t>& packed, const dither_type type, const float error_mult) const
+{
+	const trace::scope trace_scope("bilevel dither");
+
+	float divisor;
+	const std::vector<distrib_vals>& d_map = distrib_map(type, divisor);
+
+	int max_x_d = 0;
+	int max_y_d = 0;
+	for(const auto& d : d_map)
+	{
+		max_x_d = std::max(max_x_d, std::abs(d.x));
+		max_y_d = std::max(max_y_d, d.y);
+	}
+
+	//only the rows the kernel reaches are kept, with a margin on both sides so the
+	//errors going past the edges dont need any checks
+	const int rows_amount = max_y_d+1;
+	const int row_length = _image.width+max_x_d*2;
+	std::vector<float> errors(rows_amount*row_length, 0);
+
+	const size_t row_bytes = row_size();
+	const float middle = (_luminances[0]+_luminances[1])/2;
+	const bool second_lighter = _luminances[1]>_luminances[0];
+
+	for(int y = 0; y < _image.height; ++y)
+	{
+		//the row that gets reached for the first time now is the one that just finished
+		if(max_y_d!=0)
+		{
+			float* reached = errors.data()+((y+max_y_d)%rows_amount)*row_length;
+			std::fill(reached, reached+row_length, 0.0f);
+		}
+
+		float* current_errors = errors.data()+(y%rows_amount)*row_length+max_x_d;
+		uint8_t* row = packed.data()+y*row_bytes;
+
+		for(int x = 0; x < _image.width; ++x)
+		{
+			const float value = luminance(_image.pixel_color(x, y, 0), _image.pixel_color(x, y, 1), _image.pixel_color(x, y, 2))
+				+ current_errors[x]*error_mult;
+
+			const bool second = (value>middle)==second_lighter;
+			if(second)
+				row[x/8] |= 0x80>>(x%8);
+
+			const float error = (value-_luminances[second ? 1 : 0])/divisor;
+			for(const auto& d : d_map)
+			{
+				if(y+d.y >= _image.height)
+					continue;
+
+				errors[((y+d.y)%rows_amount)*row_length+max_x_d+x+d.x] += error*d.multiplier;
+			}
+		}
+	}
+}
+
+size_t bilevel_ditherer::row_size() const noexcept
+{
+	return (_image.width+7)/8;
+}
+
+const colors_base& bilevel_ditherer::colors() const noexcept
+{
+	return _colors;
+}
+
+size_t bilevel_ditherer::dark_index() const noexcept
+{
+	return _luminances[1]<_luminances[0] ? 1 : 0;
+}
@@ -0,0 +1,46 @@
+#ifndef YAN_BILEVEL_H
+#define YAN_BILEVEL_H
+
+#include <vector>
+#include <cstdint>
+
+#include "dither.h"
+
+
+namespace dither
+{
+	//ditherer for two color palettes, picking a color is a threshold test on the luminance
+	//so it only keeps a luminance per palette color and a few rows of errors around
+	//
+	//the output is bit packed, rows of 1 bit per pixel (most significant bit first) starting
+	//on a new byte, set bits are the second palette color, same layout as 1 bit pngs
+	class bilevel_ditherer : public ditherer_base
+	{
+	public:
+		bilevel_ditherer(yconv::image image, const colors_base colors);
+
+		//true if colors can be dithered with this instead of the generic ditherer
+		static bool suitable(const colors_base& colors) noexcept;
+
+		std::vector<uint8_t> dither(const dither_type type, const float error_mult = 1) const;
+
+		//bytes in a row of the packed output
+		size_t row_size() const noexcept;
+
+		const colors_base& colors() const noexcept;
+
+		//index of the darker palette color
+		size_t dark_index() const noexcept;
+
+	private:
+		static float luminance(const float r, const float g, const float b) noexcept;
+
+		void dither_ordered(std::vector<uint8_t>& packed, const float error_mult) const;
+		void dither_diffused(std::vector<uint8_t>& packed, const dither_type type, const float error_mult) const;
+
+		colors_base _colors;
+		float _luminances[2];
+	};
+};
+
+#endif
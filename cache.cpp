@@ -0,0 +1,250 @@
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+
+#include "cache.h"
+#include "trace.h"
+
+
+using namespace dither;
+
+namespace
+{
+	constexpr uint64_t rotate_left(const uint64_t value, const int amount) noexcept
+	{
+		return (value<<amount) | (value>>(64-amount));
+	}
+
+	std::string hex(const uint64_t value)
+	{
+		std::stringstream stream;
+		stream << std::hex << std::setw(16) << std::setfill('0') << value;
+
+		return stream.str();
+	}
+}
+
+result_cache::result_cache(const std::filesystem::path directory, const uintmax_t max_size)
+: _directory(directory), _max_size(max_size)
+{
+	std::filesystem::create_directories(_directory);
+}
+
+uint64_t result_cache::hash(const uint8_t* data, const size_t size, const uint64_t seed) noexcept
+{
+	const uint64_t prime1 = 0x9e3779b185ebca87ull;
+	const uint64_t prime2 = 0xc2b2ae3d27d4eb4full;
+	const uint64_t prime3 = 0x165667b19e3779f9ull;
+
+	uint64_t h = seed+prime3+size*prime1;
+
+	//8 bytes at a time, the decoded images can be big
+	size_t i = 0;
+	for(; i+8 <= size; i+=8)
+	{
+		uint64_t word;
+		std::memcpy(&word, data+i, 8);
+
+		h ^= rotate_left(word*prime2, 31)*prime1;
+		h = rotate_left(h, 27)*prime1+prime3;
+	}
+
+	for(; i < size; ++i)
+	{
+		h ^= data[i]*prime3;
+		h = rotate_left(h, 11)*prime1;
+	}
+
+	h ^= h>>33;
+	h *= prime2;
+	h ^= h>>29;
+	h *= prime3;
+	h ^= h>>32;
+
+	return h;
+}
+
+uint64_t result_cache::image_hash(const yconv::image& img) noexcept
+{
+	const trace::scope trace_scope("cache hash");
+
+	const std::string size = std::to_string(img.width) + 'x' + std::to_string(img.height) + 'x' + std::to_string(img.bpp);
+
+	return hash(reinterpret_cast<const uint8_t*>(size.data()), size.size(), hash(img.data.data(), img.data.size()));
+}
+
+std::string result_cache::key(const uint64_t image_hash, const std::string parameters)
+{
+	const uint8_t* parameters_data = reinterpret_cast<const uint8_t*>(parameters.data());
+
+	return hex(image_hash)
+		+ hex(hash(parameters_data, parameters.size(), 1))
+		+ hex(hash(parameters_data, parameters.size(), 2));
+}
+
+std::filesystem::path result_cache::entry_path(const std::string key) const
+{
+	return _directory/key.substr(0, 2)/key;
+}
+
+bool result_cache::fetch(const std::string key, const std::filesystem::path out_path) const
+{
+	const std::filesystem::path entry = entry_path(key);
+
+	//copied instead of linked so overwriting the output later cant change the cache
+	std::error_code error;
+	std::filesystem::copy_file(entry, out_path, std::filesystem::copy_options::overwrite_existing, error);
+	if(error)
+		return false;
+
+	//marks it as recently used
+	std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), error);
+
+	return true;
+}
+
+bool result_cache::fetch(const std::string key, std::ostream& out) const
+{
+	const std::filesystem::path entry = entry_path(key);
+
+	std::ifstream entry_file(entry, std::ios::binary);
+	if(!entry_file)
+		return false;
+
+	out << entry_file.rdbuf();
+	out.flush();
+
+	std::error_code error;
+	std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), error);
+
+	return true;
+}
+
+std::filesystem::path result_cache::temporary_path() const
+{
+	//starts with a dot so eviction skips it
+	std::random_device random;
+	return _directory/(".tmp-" + std::to_string(getpid()) + "-" + std::to_string(random()));
+}
+
+void result_cache::store(const std::string key, const std::filesystem::path result_path)
+{
+	const std::filesystem::path entry = entry_path(key);
+	std::filesystem::create_directories(entry.parent_path());
+
+	const std::filesystem::path temporary = temporary_path();
+
+	std::error_code error;
+	std::filesystem::copy_file(result_path, temporary, error);
+
+	const uintmax_t size = error ? 0 : std::filesystem::file_size(temporary, error);
+	if(error)
+	{
+		std::filesystem::remove(temporary, error);
+		return;
+	}
+
+	const int lock_file = open((_directory/".lock").c_str(), O_CREAT | O_RDWR, 0644);
+	if(lock_file==-1)
+	{
+		std::filesystem::remove(temporary, error);
+		return;
+	}
+
+	//the entries and their running total only change together while the lock is held
+	flock(lock_file, LOCK_EX);
+
+	//another process might have stored the same result already, then only the difference counts
+	const uintmax_t replaced_size = std::filesystem::is_regular_file(entry, error)
+		? std::filesystem::file_size(entry, error)
+		: 0;
+
+	//renaming is atomic so other processes never see a half written entry
+	std::filesystem::rename(temporary, entry, error);
+	if(error)
+	{
+		std::filesystem::remove(temporary, error);
+	} else
+	{
+		uintmax_t total_size = 0;
+		const bool known_total = read_total(total_size);
+
+		total_size = total_size+size > replaced_size ? total_size+size-replaced_size : 0;
+
+		//the directory only gets walked when the total says its over the limit (or theres no total yet)
+		if(!known_total || total_size > _max_size)
+			total_size = evict();
+
+		write_total(total_size);
+	}
+
+	flock(lock_file, LOCK_UN);
+	close(lock_file);
+}
+
+bool result_cache::read_total(uintmax_t& total_size) const
+{
+	std::ifstream total_file(_directory/".size");
+	return static_cast<bool>(total_file >> total_size);
+}
+
+void result_cache::write_total(const uintmax_t total_size) const
+{
+	std::ofstream total_file(_directory/".size", std::ios::trunc);
+	total_file << total_size << '\n';
+}
+
+uintmax_t result_cache::evict()
+{
+	struct entry_info
+	{
+		std::filesystem::path path;
+		std::filesystem::file_time_type used;
+		uintmax_t size;
+	};
+
+	std::vector<entry_info> entries;
+	uintmax_t total_size = 0;
+
+	std::error_code error;
+	for(const auto& file : std::filesystem::recursive_directory_iterator(_directory, error))
+	{
+		if(!file.is_regular_file(error) || file.path().filename().string().front()=='.')
+			continue;
+
+		const entry_info info{file.path(), file.last_write_time(error), file.file_size(error)};
+		if(error)
+			continue;
+
+		total_size += info.size;
+		entries.push_back(info);
+	}
+
+	if(total_size > _max_size)
+	{
+		std::sort(entries.begin(), entries.end(), [](const entry_info& a, const entry_info& b)
+		{
+			return a.used < b.used;
+		});
+
+		for(const auto& e : entries)
+		{
+			if(total_size <= _max_size)
+				break;
+
+			//something else might have removed it already
+			if(std::filesystem::remove(e.path, error))
+				total_size -= e.size;
+		}
+	}
+
+	return total_size;
+}
@@ -0,0 +1,58 @@
+#ifndef YAN_CACHE_H
+#define YAN_CACHE_H
+
+#include <string>
+#include <ostream>
+#include <filesystem>
+#include <cstdint>
+
+#include <yanconv.h>
+
+
+namespace dither
+{
+	//on disk cache of finished outputs, entries are named after a hash of the decoded
+	//pixels and every parameter that affects the result, and get evicted least recently used first
+	//
+	//entries are written to a temporary file and renamed into place, and renaming them in and evicting
+	//are guarded by a lock file, so several processes can share one cache directory
+	class result_cache
+	{
+	public:
+		result_cache(const std::filesystem::path directory, const uintmax_t max_size);
+
+		static uint64_t hash(const uint8_t* data, const size_t size, const uint64_t seed = 0) noexcept;
+
+		//hash of the pixels and size of an image, worth keeping around when its processed several ways
+		static uint64_t image_hash(const yconv::image& img) noexcept;
+
+		//key for an image (by its image_hash) and a string describing all the parameters its being processed with
+		static std::string key(const uint64_t image_hash, const std::string parameters);
+
+		//copies the cached result to out_path, returns false if it isnt cached
+		bool fetch(const std::string key, const std::filesystem::path out_path) const;
+		bool fetch(const std::string key, std::ostream& out) const;
+
+		void store(const std::string key, const std::filesystem::path result_path);
+
+		//unused path inside the cache directory, results headed for stdout go there first to be stored
+		std::filesystem::path temporary_path() const;
+
+	private:
+		std::filesystem::path entry_path(const std::string key) const;
+
+		//running total size of the entries, kept in a file next to them so a store doesnt have to walk
+		//the whole directory, the lock has to be held for these
+		bool read_total(uintmax_t& total_size) const;
+		void write_total(const uintmax_t total_size) const;
+
+		//walks the directory, removes the least recently used entries until its under the limit
+		//and returns the size left
+		uintmax_t evict();
+
+		std::filesystem::path _directory;
+		uintmax_t _max_size;
+	};
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <atomic>
 
 #include "generic.h"
 #include "dither.h"
@@ -34,6 +35,11 @@ color_xyz::color_xyz(const color<float>& c)
 	Z = 0.0193339f*r + 0.1191920f*g + 0.9503041f*b;
 }
 
+float color_xyz::sort_key() const noexcept
+{
+	return X;
+}
+
 int color_xyz::distance(const color_xyz& rhs) const noexcept
 {
 	return std::abs(X-rhs.X)
@@ -82,6 +88,11 @@ namespace dither
 	}
 }
 
+float color_lab::sort_key() const noexcept
+{
+	return L;
+}
+
 float color_lab::distance(const color_lab& rhs) const noexcept
 {
 	return std::abs(L-rhs.L)
@@ -89,8 +100,178 @@ float color_lab::distance(const color_lab& rhs) const noexcept
 	+ std::abs(b-rhs.b);
 }
 
-colors_base parser::parse_colors(std::string colors) noexcept
+color_cie94::color_cie94()
+{
+}
+
+color_cie94::color_cie94(const color<float>& c)
+{
+	const color_lab c_lab{c};
+
+	L = c_lab.L;
+	a = c_lab.a;
+	b = c_lab.b;
+	C = std::sqrt(a*a+b*b);
+}
+
+float color_cie94::sort_key() const noexcept
+{
+	//the lightness part of the difference is weighted by 1
+	return L*delta_e_scale;
+}
+
+float color_cie94::distance(const color_cie94& rhs) const noexcept
+{
+	const float d_L = L-rhs.L;
+	const float d_C = C-rhs.C;
+
+	//whats left of the euclidean lab distance after lightness and chroma is hue
+	const float d_a = a-rhs.a;
+	const float d_b = b-rhs.b;
+	const float d_H_squared = std::max(0.0f, d_a*d_a+d_b*d_b-d_C*d_C);
+
+	const float S_C = 1+0.045f*rhs.C;
+	const float S_H = 1+0.015f*rhs.C;
+
+	return std::sqrt(d_L*d_L + d_C*d_C/(S_C*S_C) + d_H_squared/(S_H*S_H))*delta_e_scale;
+}
+
+color_ciede2000::color_ciede2000()
+{
+}
+
+color_ciede2000::color_ciede2000(const color<float>& c)
+{
+	const color_lab c_lab{c};
+
+	L = c_lab.L;
+	a = c_lab.a;
+	b = c_lab.b;
+	C = std::sqrt(a*a+b*b);
+}
+
+float color_ciede2000::sort_key() const noexcept
+{
+	//the lightness part of the difference is divided by S_L, which stays under 1.75 while both L are in 0-100,
+	//error diffusion can push L past that, but the lightness gap grows quicker than S_L does
+	//so clamping keeps the gap between keys under the difference
+	return std::clamp(L, 0.0f, 100.0f)*delta_e_scale/1.75f;
+}
+
+float color_ciede2000::distance(const color_ciede2000& rhs) const noexcept
+{
+	const float pi = 3.14159265f;
+	const float to_radians = pi/180;
+
+	//a gets stretched for colors close to gray
+	const float G = 0.5f*(1-chroma_weight((C+rhs.C)/2));
+
+	const float a_1 = a*(1+G);
+	const float a_2 = rhs.a*(1+G);
+
+	const float C_1 = std::sqrt(a_1*a_1+b*b);
+	const float C_2 = std::sqrt(a_2*a_2+rhs.b*rhs.b);
+
+	const float d_L = rhs.L-L;
+	const float d_C = C_2-C_1;
+
+	//the hue difference straight from the a and b parts (no angles needed), its sign is the direction of the turn
+	const float hue_cross = a_1*rhs.b-a_2*b;
+	const float hue_dot = a_1*a_2+b*rhs.b;
+
+	//2*(C_1*C_2-hue_dot) cancels out to float noise for close saturated hues, so those go through the cross product
+	const float d_H_squared = hue_dot > 0
+		? 2*hue_cross*hue_cross/(C_1*C_2+hue_dot)
+		: 2*(C_1*C_2-hue_dot);
+	const float d_H = std::copysign(std::sqrt(d_H_squared), hue_cross);
+
+	const float mean_L = (L+rhs.L)/2;
+	const float mean_C = (C_1+C_2)/2;
+
+	//the mean hue points halfway between both hues (the other hue if one is gray)
+	float hue_a = (C_1==0 ? 0 : a_1/C_1) + (C_2==0 ? 0 : a_2/C_2);
+	float hue_b = (C_1==0 ? 0 : b/C_1) + (C_2==0 ? 0 : rhs.b/C_2);
+
+	if(hue_a==0 && hue_b==0 && C_1*C_2!=0)
+	{
+		//opposite hues, the mean one is a quarter turn from the smaller
+		const auto hue = [pi](const float a, const float b)
+		{
+			const float h = std::atan2(b, a);
+			return h<0 ? h+2*pi : h;
+		};
+
+		const float mean_h = std::min(hue(a_1, b), hue(a_2, rhs.b))+pi/2;
+		hue_a = std::cos(mean_h);
+		hue_b = std::sin(mean_h);
+	}
+
+	const float hue_length = std::sqrt(hue_a*hue_a+hue_b*hue_b);
+
+	//cos and sin of the mean hue and its multiples
+	const float cos_1 = hue_length==0 ? 1 : hue_a/hue_length;
+	const float sin_1 = hue_length==0 ? 0 : hue_b/hue_length;
+	const float cos_2 = cos_1*cos_1-sin_1*sin_1;
+	const float sin_2 = 2*sin_1*cos_1;
+	const float cos_3 = cos_2*cos_1-sin_2*sin_1;
+	const float sin_3 = sin_2*cos_1+cos_2*sin_1;
+	const float cos_4 = cos_2*cos_2-sin_2*sin_2;
+	const float sin_4 = 2*sin_2*cos_2;
+
+	const float T = 1
+		- 0.17f*(cos_1*std::cos(30*to_radians)+sin_1*std::sin(30*to_radians))
+		+ 0.24f*cos_2
+		+ 0.32f*(cos_3*std::cos(6*to_radians)-sin_3*std::sin(6*to_radians))
+		- 0.20f*(cos_4*std::cos(63*to_radians)+sin_4*std::sin(63*to_radians));
+
+	float mean_h_degrees = std::atan2(sin_1, cos_1)/to_radians;
+	if(mean_h_degrees < 0)
+		mean_h_degrees += 360;
+
+	//far from blue this underflows, which is slow and rounds to nothing anyway
+	const float hue_offset = (mean_h_degrees-275)/25;
+	const float d_theta = hue_offset*hue_offset > 80 ? 0 : 30*to_radians*std::exp(-hue_offset*hue_offset);
+
+	const float lightness_offset = (mean_L-50)*(mean_L-50);
+	const float S_L = 1+0.015f*lightness_offset/std::sqrt(20+lightness_offset);
+	const float S_C = 1+0.045f*mean_C;
+	const float S_H = 1+0.015f*mean_C*T;
+
+	const float R_T = -std::sin(2*d_theta)*2*chroma_weight(mean_C);
+
+	const float L_part = d_L/S_L;
+	const float C_part = d_C/S_C;
+	const float H_part = d_H/S_H;
+
+	return std::sqrt(std::max(0.0f, L_part*L_part + C_part*C_part + H_part*H_part + R_T*C_part*H_part))*delta_e_scale;
+}
+
+namespace
+{
+	std::atomic<uint64_t> total_searches = 0;
+	std::atomic<uint64_t> total_previous_won = 0;
+	std::atomic<uint64_t> total_entries = 0;
+	std::atomic<uint64_t> total_entries_skipped = 0;
+}
+
+search_counters dither::search_totals() noexcept
+{
+	return search_counters{total_searches, total_previous_won, total_entries, total_entries_skipped};
+}
+
+search_state::~search_state()
 {
+	total_searches += counters.searches;
+	total_previous_won += counters.previous_won;
+	total_entries += counters.entries;
+	total_entries_skipped += counters.entries_skipped;
+}
+
+colors_base parser::parse_colors(std::string colors)
+{
+	if(colors.find_first_not_of(" \t\n\r")==std::string::npos)
+		throw std::runtime_error("palette has no colors");
+
 	colors += ',';
 
 	std::vector<uint8_t> colors_vec;
@@ -101,6 +282,13 @@ colors_base parser::parse_colors(std::string colors) noexcept
 		switch(c)
 		{
 			case ',':
+				if(last_number=="")
+					throw std::runtime_error("empty color value");
+
+				//over 3 digits would be over 255 anyway (and could overflow stoi)
+				if(last_number.size() > 3 || std::stoi(last_number) > 255)
+					throw std::runtime_error("color value over 255: " + last_number);
+
 				colors_vec.push_back(std::stoi(last_number));
 				last_number = "";
 				break;
@@ -118,11 +306,20 @@ colors_base parser::parse_colors(std::string colors) noexcept
 				last_number += c;
 				break;
 
-			default:
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
 				break;
+
+			default:
+				throw std::runtime_error(std::string("not a color value: ") + c);
 		}
 	}
 
+	if(colors_vec.size()%3!=0)
+		throw std::runtime_error("color values dont add up to whole colors (need 3 for each)");
+
 	const int colors_amount = colors_vec.size();
 
 	colors_base parsed_colors;
@@ -134,17 +331,145 @@ colors_base parser::parse_colors(std::string colors) noexcept
 	return parsed_colors;
 }
 
-colors_base parser::parse_colors(const std::filesystem::path path) noexcept
+colors_base parser::parse_colors(const std::filesystem::path path)
 {
 	return parse_colors(generic::parse_file(path));
 }
 
+palette_base::palette_base()
+{
+}
+
+palette_base::palette_base(const colors_base colors)
+: _colors_base(colors)
+{
+}
+
+const colors_base& palette_base::colors() const noexcept
+{
+	return _colors_base;
+}
+
+indexed_image::indexed_image()
+{
+}
+
+indexed_image::indexed_image(const unsigned width, const unsigned height,
+	const std::shared_ptr<const palette_base> colors_palette, const bool alpha)
+: _width(width), _height(height), _wide(colors_palette->colors().size()+(alpha ? 1 : 0) > 256), _palette(colors_palette)
+{
+	_data.resize(static_cast<size_t>(_width)*_height*(_wide ? 2 : 1));
+
+	if(alpha)
+		_alpha.resize(static_cast<size_t>(_width)*_height);
+}
+
+unsigned indexed_image::width() const noexcept
+{
+	return _width;
+}
+
+unsigned indexed_image::height() const noexcept
+{
+	return _height;
+}
+
+bool indexed_image::wide() const noexcept
+{
+	return _wide;
+}
+
+size_t indexed_image::transparent_index() const noexcept
+{
+	return colors().size();
+}
+
+bool indexed_image::has_alpha() const noexcept
+{
+	return !_alpha.empty();
+}
+
+const colors_base& indexed_image::colors() const noexcept
+{
+	return _palette->colors();
+}
+
+const std::vector<uint8_t>& indexed_image::data() const noexcept
+{
+	return _data;
+}
+
+size_t indexed_image::index(const unsigned x, const unsigned y) const noexcept
+{
+	const size_t position = static_cast<size_t>(y)*_width+x;
+
+	if(_wide)
+		return _data[position*2] | (_data[position*2+1]<<8);
+
+	return _data[position];
+}
+
+void indexed_image::set_index(const unsigned x, const unsigned y, const size_t index) noexcept
+{
+	const size_t position = static_cast<size_t>(y)*_width+x;
+
+	if(_wide)
+	{
+		_data[position*2] = index&0xff;
+		_data[position*2+1] = index>>8;
+	} else
+	{
+		_data[position] = index;
+	}
+}
+
+uint8_t indexed_image::alpha(const unsigned x, const unsigned y) const noexcept
+{
+	return _alpha.empty() ? 255 : _alpha[static_cast<size_t>(y)*_width+x];
+}
+
+void indexed_image::set_alpha(const unsigned x, const unsigned y, const uint8_t alpha) noexcept
+{
+	_alpha[static_cast<size_t>(y)*_width+x] = alpha;
+}
+
+yconv::image indexed_image::expand() const
+{
+	const int bpp = has_alpha() ? 4 : 3;
+	const colors_base& colors_list = colors();
+
+	std::vector<uint8_t> expanded;
+	expanded.reserve(static_cast<size_t>(_width)*_height*bpp);
+	for(unsigned y = 0; y < _height; ++y)
+	{
+		for(unsigned x = 0; x < _width; ++x)
+		{
+			const size_t c_index = index(x, y);
+			const color<int> c = c_index==colors_list.size() ? color<int>{} : colors_list[c_index];
+
+			expanded.emplace_back(c.r);
+			expanded.emplace_back(c.g);
+			expanded.emplace_back(c.b);
+
+			if(bpp==4)
+				expanded.emplace_back(alpha(x, y));
+		}
+	}
+
+	return yconv::image(_width, _height, bpp, expanded);
+}
+
+void indexed_image::save(const std::filesystem::path path) const
+{
+	expand().save(path);
+}
+
 ditherer_base::ditherer_base()
 {
 }
 
-ditherer_base::ditherer_base(const yconv::image img)
-: _image(img)
+ditherer_base::ditherer_base(yconv::image img)
+: _image(std::move(img))
 {
 }
 
@@ -168,6 +493,83 @@ ditherer_base::dither_type ditherer_base::parse_type(const std::string str)
 	}
 }
 
+const std::vector<ditherer_base::distrib_vals>& ditherer_base::distrib_map(const dither_type type, float& divisor)
+{
+	static const std::vector<distrib_vals> floyd_steinberg{
+		{7, 1, 0},
+		{5, 0, 1},
+		{3, -1, 1},
+		{1, 1, 1}};
+
+	static const std::vector<distrib_vals> atkinson{
+		{1, 0, 1},
+		{1, 0, 2},
+		{1, 1, 0},
+		{1, 1, 1},
+		{1, 2, 0},
+		{1, -1, 1}};
+
+	static const std::vector<distrib_vals> jarvis{
+		{7, 1, 0},
+		{5, 2, 0},
+		{3, -2, 1},
+		{5, -1, 1},
+		{7, 0, 1},
+		{5, 1, 1},
+		{3, 2, 1},
+		{1, -2, 2},
+		{3, -1, 2},
+		{5, 0, 2},
+		{3, 1, 2},
+		{1, 2, 2}};
+
+	switch(type)
+	{
+		case dither_type::floyd_steinberg:
+			divisor = 16;
+			return floyd_steinberg;
+
+		case dither_type::atkinson:
+			divisor = 8;
+			return atkinson;
+
+		case dither_type::jarvis:
+			divisor = 48;
+			return jarvis;
+
+		default:
+			throw std::runtime_error("unsupported dither type (how did u do that?)");
+	}
+}
+
+float ditherer_base::ordered_threshold(const int x, const int y) noexcept
+{
+	const int p_width = 4;
+	const float pattern[] = {
+		0, 8, 2, 10,
+		12, 4, 14, 6,
+		3, 11, 1, 9,
+		15, 7, 13, 5};
+	const int p_size = sizeof(pattern)/sizeof(float);
+
+	return (pattern[(y%p_width)*p_width+x%p_width]+0.5f)/p_size-0.5f;
+}
+
+void ditherer_base::set_alpha_threshold(const uint8_t threshold) noexcept
+{
+	_alpha_threshold = threshold;
+}
+
+void ditherer_base::set_rolling_errors(const bool rolling) noexcept
+{
+	_rolling_errors = rolling;
+}
+
+bool ditherer_base::transparent(const int x, const int y) const noexcept
+{
+	return _image.bpp==4 && _image.pixel_color(x, y, 3)<_alpha_threshold;
+}
+
 void ditherer_base::resize_total(const unsigned total)
 {
 	const float scale = std::sqrt(static_cast<float>(total)/(_image.width*_image.height));
@@ -181,6 +583,8 @@ void ditherer_base::resize_scale(const float scale_width, const float scale_heig
 
 void ditherer_base::resize(const unsigned width, const unsigned height)
 {
+	const trace::scope trace_scope("resize");
+
 	_image.resize(width, height, image::resize_type::area_sample);
 }
 
@@ -192,4 +596,9 @@ unsigned ditherer_base::width() const noexcept
 unsigned ditherer_base::height() const noexcept
 {
 	return _image.height;
+}
+
+const yconv::image& ditherer_base::image() const noexcept
+{
+	return _image;
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define YAN_DITHER_H
 
 #include <vector>
+#include <memory>
 #include <filesystem>
 #include <climits>
 #include <cmath>
@@ -9,6 +10,8 @@
 
 #include <yanconv.h>
 
+#include "trace.h"
+
 namespace dither
 {
     template<typename T>
@@ -122,6 +125,12 @@ namespace dither
                 + std::abs(g-rhs.g)
                 + std::abs(b-rhs.b);
         }
+
+        //the distance to another color is at least how far apart their sort keys are
+        float sort_key() const noexcept
+        {
+            return r;
+        }
     };
 
     struct color_xyz
@@ -134,6 +143,8 @@ namespace dither
         color_xyz(const float X, const float Y, const float Z);
         color_xyz(const color<float>& c);
 
+        float sort_key() const noexcept;
+
         int distance(const color_xyz& rhs) const noexcept;
     };
 
@@ -149,15 +160,385 @@ namespace dither
 
         friend std::ostream& operator<<(std::ostream& out, const color_lab& rhs);
 
+        float sort_key() const noexcept;
+
         float distance(const color_lab& rhs) const noexcept;
     };
 
+    //distances of the perceptual color types are in hundredths of a delta E,
+    //so they stay precise after the palette truncates them to ints
+    constexpr float delta_e_scale = 100;
+
+    //lab color compared with the CIE94 color difference (graphic arts weights),
+    //the color distance is called with is the reference one
+    struct color_cie94
+    {
+        float L = 0;
+        float a = 0;
+        float b = 0;
+
+        //chroma, every distance needs it
+        float C = 0;
+
+        color_cie94();
+        color_cie94(const color<float>& c);
+
+        float sort_key() const noexcept;
+
+        float distance(const color_cie94& rhs) const noexcept;
+    };
+
+    //lab color compared with the CIEDE2000 color difference
+    //
+    //its too slow to measure against a whole palette, so the palette only measures the colors
+    //distance_bound cant rule out
+    struct color_ciede2000
+    {
+        float L = 0;
+        float a = 0;
+        float b = 0;
+
+        //chroma, every distance needs it
+        float C = 0;
+
+        color_ciede2000();
+        color_ciede2000(const color<float>& c);
+
+        //the distance to another color is at least how far apart their sort keys are
+        float sort_key() const noexcept;
+
+        //at most distance(rhs), only the parts that need the mean hue are left out:
+        //S_H is taken with T at its largest (under 1.58) and the rotation term at sin(60) times its weight,
+        //turned whichever way takes the most away from the chroma and hue parts
+        //
+        //the rotation term only matters around blue, when neither color is on the blue side (b under 0)
+        //their mean hue is at least 95 degrees away and it rounds to nothing
+        //
+        //colors clearly further than limit get a quicker and looser bound (still over limit)
+        float distance_bound(const color_ciede2000& rhs, const float limit) const noexcept
+        {
+            const float rotation_weight = (b>=0 && rhs.b>=0) ? 0 : 0.8660254f;
+
+            const float d_L = L-rhs.L;
+            const float mean_L = (L+rhs.L)/2;
+
+            {
+                //S_L stays under 1+0.015*|mean_L-50|, G under 0.5,
+                //and the rotation term leaves at least 1-rotation_weight of the rest
+                const float d_a = a-rhs.a;
+                const float d_b = b-rhs.b;
+                const float S_L = 1+0.015f*std::abs(mean_L-50);
+                const float S_C = 1+0.045f*1.5f*(C+rhs.C)/2;
+
+                const float quick_squared = (d_L*d_L/(S_L*S_L) + (1-rotation_weight)*(d_a*d_a+d_b*d_b)/(S_C*S_C))
+                    *delta_e_scale*delta_e_scale*0.98f;
+
+                if(quick_squared > limit*limit)
+                    return std::sqrt(quick_squared);
+            }
+
+            const float G = 0.5f*(1-chroma_weight((C+rhs.C)/2));
+
+            const float a_1 = a*(1+G);
+            const float a_2 = rhs.a*(1+G);
+
+            const float C_1 = std::sqrt(a_1*a_1+b*b);
+            const float C_2 = std::sqrt(a_2*a_2+rhs.b*rhs.b);
+
+            const float d_C = std::abs(C_2-C_1);
+            const float d_H = std::sqrt(std::max(0.0f, (a_1-a_2)*(a_1-a_2)+(b-rhs.b)*(b-rhs.b)-d_C*d_C));
+
+            const float mean_C = (C_1+C_2)/2;
+
+            const float lightness_offset = (mean_L-50)*(mean_L-50);
+            const float S_L = 1+0.015f*lightness_offset/std::sqrt(20+lightness_offset);
+            const float S_C = 1+0.045f*mean_C;
+            const float S_H = 1+0.015f*mean_C*1.58f;
+
+            const float R_T = rotation_weight==0 ? 0 : rotation_weight*2*chroma_weight(mean_C);
+
+            const float L_part = d_L/S_L;
+            const float C_part = d_C/S_C;
+            const float H_part = d_H/S_H;
+
+            //the hue part is only a lower limit, past the lowest point the real one can only add more
+            const float C_H_parts = H_part >= R_T*C_part/2
+                ? C_part*C_part + H_part*H_part - R_T*C_part*H_part
+                : C_part*C_part*(1-R_T*R_T/4);
+
+            //a bit under, so float rounding never puts it over the exact distance
+            return std::sqrt(L_part*L_part + C_H_parts)*delta_e_scale*0.99f;
+        }
+
+        float distance(const color_ciede2000& rhs) const noexcept;
+
+    private:
+        //how much the chroma counts in G and the rotation term, from 0 for gray up to 1
+        static float chroma_weight(const float chroma) noexcept
+        {
+            const float chroma_7 = chroma*chroma*chroma*chroma*chroma*chroma*chroma;
+            return std::sqrt(chroma_7/(chroma_7+6103515625.0f));
+        }
+    };
+
     typedef std::vector<color<int>> colors_base;
+
+    //totals of every search_state so far
+    struct search_counters
+    {
+        uint64_t searches = 0;
+
+        //searches the previous winner won again
+        uint64_t previous_won = 0;
+
+        //palette entries measured and the ones skipped without measuring them
+        uint64_t entries = 0;
+        uint64_t entries_skipped = 0;
+    };
+
+    search_counters search_totals() noexcept;
+
+    //state of nearest color searches that go one after another (like the pixels of an image),
+    //pixels next to each other tend to get the same color so the previous winner bounds the next search
+    //
+    //not thread safe, every thread dithering needs its own
+    class search_state
+    {
+    public:
+        search_state() = default;
+        ~search_state();
+
+        search_state(const search_state&) = delete;
+        search_state& operator=(const search_state&) = delete;
+
+        size_t previous = 0;
+
+        //added to the totals when the state is destroyed
+        search_counters counters;
+    };
+
     class parser
     {
     public:
-        static colors_base parse_colors(std::string colors) noexcept;
-        static colors_base parse_colors(const std::filesystem::path path) noexcept;
+        //comma separated r,g,b values, throws if theres anything else in there
+        static colors_base parse_colors(std::string colors);
+        static colors_base parse_colors(const std::filesystem::path path);
+    };
+
+    class palette_base
+    {
+    public:
+        palette_base();
+        palette_base(const colors_base colors);
+        virtual ~palette_base() = default;
+
+        const colors_base& colors() const noexcept;
+
+    protected:
+        colors_base _colors_base;
+    };
+
+    //palette indices of a dithered image, only expanded to colors when saved
+    class indexed_image
+    {
+    public:
+        indexed_image();
+        indexed_image(const unsigned width, const unsigned height,
+            const std::shared_ptr<const palette_base> colors_palette, const bool alpha = false);
+
+        unsigned width() const noexcept;
+        unsigned height() const noexcept;
+
+        //indices are stored in 2 bytes each if the palette has more than 256 colors
+        bool wide() const noexcept;
+
+        //index of pixels that were too transparent to dither, one past the last palette color
+        size_t transparent_index() const noexcept;
+        bool has_alpha() const noexcept;
+
+        const colors_base& colors() const noexcept;
+        const std::vector<uint8_t>& data() const noexcept;
+
+        size_t index(const unsigned x, const unsigned y) const noexcept;
+        void set_index(const unsigned x, const unsigned y, const size_t index) noexcept;
+
+        uint8_t alpha(const unsigned x, const unsigned y) const noexcept;
+        void set_alpha(const unsigned x, const unsigned y, const uint8_t alpha) noexcept;
+
+        yconv::image expand() const;
+        void save(const std::filesystem::path path) const;
+
+    private:
+        unsigned _width = 0;
+        unsigned _height = 0;
+        bool _wide = false;
+
+        std::shared_ptr<const palette_base> _palette;
+
+        std::vector<uint8_t> _data;
+        std::vector<uint8_t> _alpha;
+    };
+
+    template<class T_color>
+    class palette : public palette_base
+    {
+    public:
+        typedef std::vector<T_color> colors_type;
+
+        palette() {};
+
+        palette(const colors_base colors)
+        : palette_base(colors)
+        {
+            const trace::scope trace_scope("palette conversion");
+
+            _colors.reserve(_colors_base.size());
+            for(const auto& c : _colors_base)
+                _colors.emplace_back(T_color{c});
+
+            _sorted_indices.resize(_colors.size());
+            for(size_t i = 0; i < _colors.size(); ++i)
+                _sorted_indices[i] = i;
+
+            std::stable_sort(_sorted_indices.begin(), _sorted_indices.end(), [this](const uint32_t lhs, const uint32_t rhs)
+            {
+                return _colors[lhs].sort_key() < _colors[rhs].sort_key();
+            });
+
+            _sorted_colors.reserve(_colors.size());
+            _sorted_keys.reserve(_colors.size());
+            for(const uint32_t i : _sorted_indices)
+            {
+                _sorted_colors.push_back(_colors[i]);
+                _sorted_keys.push_back(_colors[i].sort_key());
+            }
+        }
+
+        size_t nearest_index(const T_color c) const noexcept
+        {
+            size_t closest_index = 0;
+            int closest_distance = INT_MAX;
+
+            for(size_t i = 0; i < _colors.size(); ++i)
+            {
+                const int c_distance = _colors[i].distance(c);
+
+
+                if(c_distance==0)
+                    return i;
+
+                if(c_distance < closest_distance)
+                {
+                    closest_index = i;
+                    closest_distance = c_distance;
+                }
+            }
+
+            return closest_index;
+        }
+
+        //same result as nearest_index(c), but starts from the previous winner and then only measures the
+        //entries with sort keys close enough to beat the closest one so far
+        size_t nearest_index(const T_color c, search_state& state) const noexcept
+        {
+            //a plain search over a few colors is quicker than keeping track of all this,
+            //unless the distance is slow enough that skipping even a few of them pays off
+            if(_colors.size() < sorted_search_size && !bounded)
+            {
+                const size_t closest_index = nearest_index(c);
+
+                ++state.counters.searches;
+                state.counters.entries += _colors.size();
+
+                if(closest_index==state.previous)
+                    ++state.counters.previous_won;
+
+                state.previous = closest_index;
+
+                return closest_index;
+            }
+
+            const size_t previous_index = state.previous < _colors.size() ? state.previous : 0;
+
+            size_t closest_index = previous_index;
+            int closest_distance = _colors[closest_index].distance(c);
+
+            size_t measured = 1;
+            const auto measure = [&](const size_t position)
+            {
+                const size_t i = _sorted_indices[position];
+                if(i==previous_index)
+                    return;
+
+                //cant beat or tie the closest one, ints only round down
+                if constexpr(bounded)
+                {
+                    if(_sorted_colors[position].distance_bound(c, closest_distance+1) >= closest_distance+1)
+                        return;
+                }
+
+                ++measured;
+
+                //ties go to the lower index like in the plain search
+                const int c_distance = _sorted_colors[position].distance(c);
+                if(c_distance < closest_distance || (c_distance==closest_distance && i < closest_index))
+                {
+                    closest_index = i;
+                    closest_distance = c_distance;
+                }
+            };
+
+            //entries further away in either direction are only further from c
+            const float key = c.sort_key();
+            const size_t middle = std::lower_bound(_sorted_keys.begin(), _sorted_keys.end(), key)-_sorted_keys.begin();
+
+            for(size_t position = middle; position < _sorted_keys.size(); ++position)
+            {
+                if(static_cast<int>(_sorted_keys[position]-key) > closest_distance)
+                    break;
+
+                measure(position);
+            }
+
+            for(size_t position = middle; position-- > 0;)
+            {
+                if(static_cast<int>(key-_sorted_keys[position]) > closest_distance)
+                    break;
+
+                measure(position);
+            }
+
+            ++state.counters.searches;
+            state.counters.entries += measured;
+            state.counters.entries_skipped += _colors.size()-measured;
+
+            if(closest_index==previous_index)
+                ++state.counters.previous_won;
+
+            state.previous = closest_index;
+
+            return closest_index;
+        }
+
+        color<int> nearest_color(const T_color c) const noexcept
+        {
+            return _colors_base[nearest_index(c)];
+        }
+
+        //smaller palettes always use the plain search, its branch free loop measured quicker than both this
+        //and stopping each distance early once it passes the previous winner for every size from 3 to 48
+        static constexpr size_t sorted_search_size = 64;
+
+    private:
+        //slow distances come with a cheap bound to rule colors out before measuring them
+        static constexpr bool bounded = requires(const T_color c){c.distance_bound(c, 0);};
+
+        colors_type _colors;
+
+        //the colors ordered by their sort keys
+        std::vector<uint32_t> _sorted_indices;
+        colors_type _sorted_colors;
+        std::vector<float> _sorted_keys;
     };
 
     class ditherer_base
@@ -165,12 +546,31 @@ namespace dither
     public:
         enum class dither_type{floyd_steinberg, atkinson, jarvis, ordered};
 
+        struct distrib_vals
+        {
+            int multiplier;
+            int x;
+            int y;
+        };
+
         ditherer_base();
-        ditherer_base(const yconv::image img);
+        ditherer_base(yconv::image img);
         virtual ~ditherer_base() = default;
 
         static dither_type parse_type(const std::string str);
 
+        //pixels with alpha under the threshold are left out of dithering and error diffusion,
+        //they get the palette size as their index (0 keeps every pixel)
+        void set_alpha_threshold(const uint8_t threshold) noexcept;
+
+        //error diffusion keeps only the few rows of errors the kernel reaches instead of a whole
+        //image worth of them, same result with a lot less memory (resuming needs the whole buffer still)
+        void set_rolling_errors(const bool rolling) noexcept;
+
+        //rows of errors kept with rolling errors, none of the kernels reach further down than
+        //2 rows, plus one for the error that wraps around the right edge into the next row
+        static constexpr int rolling_rows = 4;
+
         void resize_total(const unsigned total);
         void resize_scale(const float scale_width, const float scale_height);
         void resize(const unsigned width, const unsigned height);
@@ -178,219 +578,405 @@ namespace dither
         unsigned width() const noexcept;
         unsigned height() const noexcept;
 
+        const yconv::image& image() const noexcept;
+
     protected:
+        //error diffusion kernel of an error diffusing dither type, divisor gets set to its divisor
+        static const std::vector<distrib_vals>& distrib_map(const dither_type type, float& divisor);
+
+        //threshold of the 4x4 bayer matrix at a pixel, from -0.5 to 0.5
+        static float ordered_threshold(const int x, const int y) noexcept;
+
+        bool transparent(const int x, const int y) const noexcept;
+
         yconv::image _image;
+        int _alpha_threshold = 0;
+        bool _rolling_errors = false;
     };
 
     template<class T_color>
     class ditherer : public ditherer_base
     {
     public:
-        struct distrib_vals
+        typedef palette<T_color> palette_type;
+
+        ditherer() {};
+
+        ditherer(yconv::image image, const colors_base colors)
+        : ditherer_base(std::move(image)), _palette(std::make_shared<const palette_type>(colors))
         {
-            int multiplier;
-            int x;
-            int y;
-        };
+        }
 
-        typedef std::vector<T_color> colors_type;
+        ditherer(yconv::image image, const std::shared_ptr<const palette_type> colors_palette)
+        : ditherer_base(std::move(image)), _palette(colors_palette)
+        {
+        }
 
-        ditherer() {};
+        indexed_image dither(const dither_type type, const float error_mult = 1) const
+        {
+            indexed_image out(_image.width, _image.height, _palette, _image.bpp==4);
+
+            dither_indexed(type, [&](const int x, const int y, const size_t index)
+            {
+                out.set_index(x, y, index);
 
-        ditherer(const yconv::image image, const colors_base colors)
-        : ditherer_base(image), _colors_base(colors)
+                if(_image.bpp==4)
+                    out.set_alpha(x, y, _image.pixel_color(x, y, 3));
+            }, error_mult);
+
+            return out;
+        }
+
+        //writes the dithered image into out (same bpp as the source image), rows are stride bytes apart
+        void dither(const dither_type type, uint8_t* out, const size_t stride, const float error_mult = 1) const
         {
-            _colors.reserve(_colors_base.size());
-            for(const auto& c : _colors_base)
-                _colors.emplace_back(T_color{c});
+            const colors_base& colors_list = _palette->colors();
+
+            dither_indexed(type, [&](const int x, const int y, const size_t index)
+            {
+                const color<int> out_color = index==colors_list.size() ? color<int>{} : colors_list[index];
+
+                uint8_t* out_pixel = out+y*stride+x*_image.bpp;
+                out_pixel[0] = out_color.r;
+                out_pixel[1] = out_color.g;
+                out_pixel[2] = out_color.b;
+
+                if(_image.bpp==4)
+                {
+                    out_pixel[3] = _image.pixel_color(x, y, 3);
+                }
+            }, error_mult);
         }
 
-        yconv::image dither(const dither_type type, const float error_mult = 1) const
+        //calls func(x, y, palette_index) for every pixel in row order instead of building an image
+        template<typename F>
+        void dither_indexed(const dither_type type, F func, const float error_mult = 1) const
         {
-            if(_image.bpp!=3 && _image.bpp!=4)
-                throw std::runtime_error(std::string("cant dither image with bits per pixel value: ") + std::to_string(_image.bpp));
+            dither_until(type, func, [](){return false;}, error_mult);
+        }
+
+        //same as dither_indexed but stop() gets checked before every row,
+        //returns false if it returned true and the rest of the image got skipped
+        template<typename F, typename S>
+        bool dither_until(const dither_type type, F func, S stop, const float error_mult = 1) const
+        {
+            check_bpp();
 
-            switch(type)
+            if(type==dither_type::ordered)
             {
-                case dither_type::ordered:
-                return dither_ordered(std::vector<float>{0.25f, 0.5f, 0.75f, 1.0f}, 2, error_mult);
-
-                case dither_type::floyd_steinberg:
-                case dither_type::atkinson:
-                case dither_type::jarvis:
-                default:
-                return dither_generic(type, error_mult);
+                return dither_ordered(0, 0, _image.width, _image.height, func, stop, error_mult);
+            } else
+            {
+                std::vector<color<float>> errors(_rolling_errors ?
+                    static_cast<size_t>(_image.width)*rolling_rows
+                    : error_buffer_size());
+
+                return dither_kernel(type, error_mult, errors, 0, func, stop);
             }
         }
 
-    private:
-        yconv::image dither_ordered(const std::vector<float> pattern, const int p_width, const float error_mult) const
+        //error diffusion continuing from row y_begin, errors has to hold the state left by a previous
+        //dither_resume of an image thats the same as this one above y_begin, or be fresh (zeroed)
+        template<typename F>
+        void dither_resume(const dither_type type, std::vector<color<float>>& errors, const int y_begin,
+            F func, const float error_mult = 1) const
         {
-            /*const int p_height = pattern.size()/p_width;
+            check_bpp();
 
-            std::vector<uint8_t> data;
+            if(type==dither_type::ordered)
+                throw std::runtime_error("ordered dithering doesnt diffuse errors");
 
-            data.reserve(_image.width*_image.height*_image.bpp);
+            if(errors.size()!=error_buffer_size())
+                throw std::runtime_error("error buffer doesnt match the image size");
+
+            dither_kernel(type, error_mult, errors, y_begin, func, [](){return false;});
+        }
+
+        //ordered dithering of the pixels in [x_begin, x_end) and [y_begin, y_end)
+        template<typename F>
+        void dither_region(const int x_begin, const int y_begin, const int x_end, const int y_end,
+            F func, const float error_mult = 1) const
+        {
+            check_bpp();
+
+            dither_ordered(x_begin, y_begin, x_end, y_end, func, [](){return false;}, error_mult);
+        }
+
+        //every pixel with its ordered dithering offset added and converted to T_color (transparent ones
+        //are left default), that only depends on the image and the palette size so its worth keeping
+        //around when the same image gets dithered with several palettes of that size
+        std::vector<T_color> ordered_colors(const float error_mult = 1) const
+        {
+            check_bpp();
+
+            const trace::scope trace_scope("ordered conversion");
+
+            const float spread = ordered_spread(error_mult);
+
+            std::vector<T_color> converted(static_cast<size_t>(_image.width)*_image.height);
             for(int y = 0; y < _image.height; ++y)
             {
                 for(int x = 0; x < _image.width; ++x)
                 {
-                    const color<int> c = color<int>{
-                        _image.pixel_color(x, y, 0),
-                        _image.pixel_color(x, y, 1),
-                        _image.pixel_color(x, y, 2)};
+                    if(!transparent(x, y))
+                        converted[static_cast<size_t>(y)*_image.width+x] = ordered_color(x, y, spread);
+                }
+            }
 
-                    const color<int> error{0, 0, 0};
-                    for(int p = 0; p < pattern.size(); ++p)
-                    {
-                        const color<int> test_color = c + error;
-                        const color<int> closest_color = nearest_color(T_color(test_color));
+            return converted;
+        }
 
-                    }
+        //same as dither_until with ordered dithering, but with the pixels already converted by
+        //ordered_colors of this image with a palette the same size as this ones
+        template<typename F, typename S>
+        bool dither_ordered_colors(const std::vector<T_color>& converted, F func, S stop) const
+        {
+            if(converted.size()!=static_cast<size_t>(_image.width)*_image.height)
+                throw std::runtime_error("converted colors dont match the image size");
+
+            const trace::scope trace_scope("dither region");
 
-                    data.emplace_back();
-                    data.emplace_back();
-                    data.emplace_back();
+            const size_t colors_amount = _palette->colors().size();
 
-                    if(_image.bpp==4)
+            search_state search;
+
+            for(int y = 0; y < _image.height; ++y)
+            {
+                if(stop())
+                    return false;
+
+                for(int x = 0; x < _image.width; ++x)
+                {
+                    if(transparent(x, y))
                     {
-                        data.emplace_back(_image.pixel_color(x, y, 3));
+                        func(x, y, colors_amount);
+                        continue;
                     }
+
+                    func(x, y, _palette->nearest_index(converted[static_cast<size_t>(y)*_image.width+x], search));
                 }
             }
 
-            return yconv::image(_image.width, _image.height, _image.bpp, data);*/
-            //TODO
+            return true;
         }
 
-        yconv::image dither_generic(const dither_type type, const float error_mult) const
+        size_t error_buffer_size() const noexcept
         {
-            const size_t img_size = _image.width*_image.height*_image.bpp;
+            return _image.width*_image.height*_image.bpp;
+        }
 
-            std::vector<color<float>> errors(img_size);
+        const colors_base& colors() const noexcept
+        {
+            return _palette->colors();
+        }
 
-            std::vector<uint8_t> data;
+        std::shared_ptr<const palette_type> colors_palette() const noexcept
+        {
+            return _palette;
+        }
 
-            data.reserve(img_size);
-            for(int y = 0; y < _image.height; ++y)
+    private:
+        void check_bpp() const
+        {
+            if(_image.bpp!=3 && _image.bpp!=4)
+                throw std::runtime_error(std::string("cant dither image with bits per pixel value: ") + std::to_string(_image.bpp));
+        }
+
+        //roughly the distance between neighbouring colors of an evenly spread palette
+        float ordered_spread(const float error_mult) const noexcept
+        {
+            return error_mult*255/std::cbrt(static_cast<float>(_palette->colors().size()));
+        }
+
+        T_color ordered_color(const int x, const int y, const float spread) const noexcept
+        {
+            const float offset = ordered_threshold(x, y)*spread;
+
+            const color<float> c{
+                _image.pixel_color(x, y, 0)+offset,
+                _image.pixel_color(x, y, 1)+offset,
+                _image.pixel_color(x, y, 2)+offset};
+
+            return T_color{c};
+        }
+
+        template<typename F, typename S>
+        bool dither_ordered(const int x_begin, const int y_begin, const int x_end, const int y_end,
+            F func, S stop, const float error_mult) const
+        {
+            const colors_base& colors_list = _palette->colors();
+
+            const float spread = ordered_spread(error_mult);
+
+            const trace::scope trace_scope("dither region");
+
+            search_state search;
+
+            for(int y = y_begin; y < y_end; ++y)
             {
-                for(int x = 0; x < _image.width; ++x)
+                if(stop())
+                    return false;
+
+                for(int x = x_begin; x < x_end; ++x)
                 {
-                    const color<float> c = (errors[y*_image.width+x]*error_mult)
-                        + color<float>{
-                        static_cast<float>(_image.pixel_color(x, y, 0)),
-                        static_cast<float>(_image.pixel_color(x, y, 1)),
-                        static_cast<float>(_image.pixel_color(x, y, 2))};
+                    if(transparent(x, y))
+                    {
+                        func(x, y, colors_list.size());
+                        continue;
+                    }
 
-                        const color<int> out_color = nearest_color(T_color{c});
+                    func(x, y, _palette->nearest_index(ordered_color(x, y, spread), search));
+                }
+            }
 
-                        const color<float> error = c-out_color.cast<float>();
+            return true;
+        }
 
-                        switch(type)
-                        {
-                            case dither_type::floyd_steinberg:
-                                error_mapped(16, std::vector<distrib_vals>{
-                                    {7, 1, 0},
-                                    {5, 0, 1},
-                                    {3, -1, 1},
-                                    {1, 1, 1}},
-                                    errors, error, x, y);
-                                break;
-
-                            case dither_type::atkinson:
-                                error_mapped(8, std::vector<distrib_vals>{
-                                    {1, 0, 1},
-                                    {1, 0, 2},
-                                    {1, 1, 0},
-                                    {1, 1, 1},
-                                    {1, 2, 0},
-                                    {1, -1, 1}},
-                                    errors, error, x, y);
-                                break;
-
-                            case dither_type::jarvis:
-                                error_mapped(48, std::vector<distrib_vals>{
-                                    {7, 1, 0},
-                                    {5, 2, 0},
-                                    {3, -2, 1},
-                                    {5, -1, 1},
-                                    {7, 0, 1},
-                                    {5, 1, 1},
-                                    {3, 2, 1},
-                                    {1, -2, 2},
-                                    {3, -1, 2},
-                                    {5, 0, 2},
-                                    {3, 1, 2},
-                                    {1, 2, 2}},
-                                    errors, error, x, y);
-                                break;
-
-                            default:
-                                throw std::runtime_error("unsupported dither type (how did u do that?)");
-                        }
+        template<typename F, typename S>
+        bool dither_kernel(const dither_type type, const float error_mult, std::vector<color<float>>& errors,
+            const int y_begin, F func, S stop) const
+        {
+            const colors_base& colors_list = _palette->colors();
 
-                        data.emplace_back(out_color.r);
-                        data.emplace_back(out_color.g);
-                        data.emplace_back(out_color.b);
+            float divisor;
+            const std::vector<distrib_vals>& d_map = distrib_map(type, divisor);
 
-                        if(_image.bpp==4)
+            const int max_y_d = rolling_rows-1;
+
+            //a smaller buffer is a rolling one, each row reuses the one max_y_d rows above it
+            const bool rolling = errors.size()!=error_buffer_size();
+
+            const size_t resume_index = static_cast<size_t>(y_begin)*_image.width;
+
+            search_state search;
+
+            const auto dither_pixel = [&](const int x, const int y, const size_t min_index) -> size_t
+            {
+                const size_t error_index = static_cast<size_t>(y)*_image.width+x;
+
+                const color<float> c = (errors[rolling ? error_index%errors.size() : error_index]*error_mult)
+                    + color<float>{
+                    static_cast<float>(_image.pixel_color(x, y, 0)),
+                    static_cast<float>(_image.pixel_color(x, y, 1)),
+                    static_cast<float>(_image.pixel_color(x, y, 2))};
+
+                    const size_t out_index = _palette->nearest_index(T_color{c}, search);
+                    const color<int>& out_color = colors_list[out_index];
+
+                    const color<float> error = c-out_color.cast<float>();
+
+                    error_mapped(divisor, d_map, errors, error, x, y, min_index, rolling);
+
+                    return out_index;
+            };
+
+            if(y_begin!=0)
+            {
+                //errors above y_begin are final already, the ones below get rebuilt by redoing
+                //the rows that diffuse into them (only keeping what lands from y_begin on)
+                std::fill(errors.begin()+resume_index, errors.end(), color<float>{});
+
+                for(int y = std::max(0, y_begin-max_y_d); y < y_begin; ++y)
+                {
+                    for(int x = 0; x < _image.width; ++x)
+                    {
+                        if(!transparent(x, y))
+                            dither_pixel(x, y, resume_index);
+                    }
+                }
+            }
+
+            //traced in bands of rows so theres not an event for every row
+            const int trace_rows = 64;
+            for(int band_y = y_begin; band_y < _image.height; band_y += trace_rows)
+            {
+                const trace::scope trace_scope("dither rows");
+
+                for(int y = band_y; y < std::min<int>(_image.height, band_y+trace_rows); ++y)
+                {
+                    if(stop())
+                        return false;
+
+                    if(rolling)
+                    {
+                        //the row above this one is done so its space goes to the first row the kernel reaches now
+                        const auto reached = errors.begin()+((y+max_y_d)%rolling_rows)*_image.width;
+                        std::fill(reached, reached+_image.width, color<float>{});
+                    }
+
+                    for(int x = 0; x < _image.width; ++x)
+                    {
+                        if(transparent(x, y))
                         {
-                            data.emplace_back(_image.pixel_color(x, y, 3));
+                            func(x, y, colors_list.size());
+                            continue;
                         }
+
+                        func(x, y, dither_pixel(x, y, 0));
+                    }
                 }
             }
 
-            return yconv::image(_image.width, _image.height, _image.bpp, data);
+            return true;
         }
 
-        void error_mapped(const float divisor, const std::vector<distrib_vals> distrib_map,
-            std::vector<color<float>>& errors, const color<float> error, const int x, const int y) const noexcept
+        void error_mapped(const float divisor, const std::vector<distrib_vals>& distrib_map,
+            std::vector<color<float>>& errors, const color<float> error, const int x, const int y,
+            const size_t min_index, const bool rolling) const noexcept
         {
             const color<float> val = error * (1/divisor);
 
             for(const auto& d_val : distrib_map)
                 error_distribute(errors, val*d_val.multiplier, x, y,
-                    d_val.x, d_val.y);
+                    d_val.x, d_val.y, min_index, rolling);
         }
 
-        void error_distribute(std::vector<color<float>>& errors, const color<float> error, const int x, const int y, const int x_d, const int y_d) const noexcept
+        void error_distribute(std::vector<color<float>>& errors, const color<float> error, const int x, const int y,
+            const int x_d, const int y_d, const size_t min_index, const bool rolling) const noexcept
         {
             if(((x_d>0 && x!=_image.width-x_d) || (x_d<0 && x!=std::abs(x_d+1)) || x_d==0) &&
                 ((y_d>0 && y!=_image.height-y_d) || (y_d<0 && y!=std::abs(y_d+1)) || y_d==0))
             {
-                errors[(y+y_d)*_image.width+(x+x_d)] += error;
+                //error doesnt leak into (or across) transparent areas
+                if(_alpha_threshold!=0 && x+x_d>=0 && x+x_d<_image.width && y+y_d<_image.height && transparent(x+x_d, y+y_d))
+                    return;
+
+                const size_t index = (y+y_d)*_image.width+(x+x_d);
+                if(index>=min_index)
+                    errors[rolling ? index%errors.size() : index] += error;
             }
         }
 
-        color<int> nearest_color(const T_color c) const noexcept
-        {
-            color<int> closest_color;
-            int closest_distance = INT_MAX;
-
-            auto c_color = _colors.cbegin();
-            auto c_color_base = _colors_base.cbegin();
-
-            for(;c_color!=_colors.cend(); ++c_color, ++c_color_base)
-            {
-                const int c_distance = c_color->distance(c);
-
-
-                if(c_distance==0)
-                    return *c_color_base;
-
-                if(c_distance < closest_distance)
-                {
-                    closest_color = *c_color_base;
-                    closest_distance = c_distance;
-                }
-            }
+        std::shared_ptr<const palette_type> _palette;
+    };
 
-            return closest_color;
+    //calls func with a default constructed color of the type the distance function name refers to
+    //returns false if theres no distance function with that name
+    template<typename F>
+    bool with_distance(const std::string name, F func)
+    {
+        if(name=="RGB")
+        {
+            func(color<int>{});
+        } else if(name=="LAB")
+        {
+            func(color_lab{});
+        } else if(name=="XYZ")
+        {
+            func(color_xyz{});
+        } else if(name=="CIE94")
+        {
+            func(color_cie94{});
+        } else if(name=="CIEDE2000")
+        {
+            func(color_ciede2000{});
+        } else
+        {
+            return false;
         }
 
-        colors_type _colors;
-        colors_base _colors_base;
-    };
+        return true;
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,521 @@
+#ifndef YAN_JOB_H
+#define YAN_JOB_H
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <future>
+#include <functional>
+#include <memory>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+
+#include "dither.h"
+#include "bilevel.h"
+#include "sequence.h"
+#include "scheduler.h"
+#include "stream.h"
+#include "totext.h"
+#include "png.h"
+
+
+struct dither_args
+{
+	std::string width = "";
+	std::string height = "";
+	std::string total = "";
+	std::string dither_type = "";
+	std::string save_path = "";
+	std::string format = "";
+	std::string png_level = "";
+	std::string png_filter = "";
+	std::string alpha_threshold = "";
+
+	//anything but empty dithers two color palettes going to pbm or indexed output by luminance alone
+	std::string bilevel = "";
+
+	//anything but empty keeps only a few rows of diffused errors, doesnt change the output
+	std::string rolling_errors = "";
+};
+
+//every field that changes the output, so not the save path or rolling errors
+inline std::string describe_args(const dither_args a)
+{
+	return a.width + '\n' + a.height + '\n' + a.total + '\n' + a.dither_type + '\n' + a.format + '\n'
+		+ a.png_level + '\n' + a.png_filter + '\n' + a.alpha_threshold + '\n' + a.bilevel;
+}
+
+//extension of the file save_generic writes for an output format
+inline std::string format_extension(const std::string format)
+{
+	if(format=="raw")
+		return ".raw";
+
+	if(format=="pbm")
+		return ".pbm";
+
+	if(format=="ppm")
+		return ".ppm";
+
+	if(format=="pam")
+		return ".pam";
+
+	return ".png";
+}
+
+//stdout if the save path is -, otherwise file gets opened at the save path with the extension
+inline std::ostream& open_output(const dither_args a, const std::string extension, std::ofstream& file)
+{
+	if(a.save_path=="-")
+		return std::cout;
+
+	const std::string path = a.save_path+extension;
+
+	file.open(path, std::ios::binary);
+	if(!file)
+		throw std::runtime_error(std::string("cant open file for writing: ") + path);
+
+	return file;
+}
+
+inline png::encode_options png_options(const dither_args a)
+{
+	png::encode_options options;
+
+	if(a.png_level!="")
+		options.level = std::stoi(a.png_level);
+
+	if(a.png_filter!="")
+		options.filter = png::parse_filter(a.png_filter);
+
+	return options;
+}
+
+//with an alpha threshold rgb and rgba images are used as they are, only other layouts get converted
+inline void convert_image(yconv::image& img, const std::string alpha_threshold)
+{
+	if(alpha_threshold=="" || (img.bpp!=3 && img.bpp!=4))
+	{
+		const trace::scope trace_scope("bpp_resize");
+		img.bpp_resize(alpha_threshold!="" && img.bpp==2 ? 4 : 3);
+	}
+}
+
+inline yconv::image load_image(const std::filesystem::path path, const std::string alpha_threshold)
+{
+	yconv::image img;
+	{
+		const trace::scope trace_scope("load");
+		img = yconv::image{path};
+	}
+
+	convert_image(img, alpha_threshold);
+
+	return img;
+}
+
+//size resize_generic resizes an image to, for a pyramid its biggest level
+inline std::pair<unsigned, unsigned> target_size(const unsigned width, const unsigned height, const dither_args a)
+{
+	if(a.width!="" || a.height!="")
+	{
+		return {a.width=="" ? width : static_cast<unsigned>(std::stoi(a.width)),
+			a.height=="" ? height : static_cast<unsigned>(std::stoi(a.height))};
+	} else if(a.total!="")
+	{
+		unsigned biggest = 0;
+
+		std::stringstream totals_stream(a.total);
+		std::string total;
+		while(std::getline(totals_stream, total, ','))
+			biggest = std::max<unsigned>(biggest, std::stoi(total));
+
+		const float scale = std::sqrt(static_cast<float>(biggest)/(static_cast<float>(width)*height));
+		return {static_cast<unsigned>(width*scale), static_cast<unsigned>(height*scale)};
+	}
+
+	return {width, height};
+}
+
+//rough peak memory of dithering and saving one already resized image (or pyramid level)
+inline size_t level_memory(const unsigned width, const unsigned height, const unsigned bpp, const dither_args a)
+{
+	const size_t pixels = static_cast<size_t>(width)*height;
+
+	const size_t errors = a.rolling_errors!="" ?
+		static_cast<size_t>(width)*dither::ditherer_base::rolling_rows*sizeof(dither::color<float>)
+		: pixels*bpp*sizeof(dither::color<float>);
+
+	//indices (2 bytes over 256 colors) and alpha
+	const size_t indexed = pixels*(bpp==4 ? 3 : 2);
+
+	//expanded image, filtered rows and the deflated bands
+	const size_t saving = pixels*bpp*3;
+
+	return pixels*bpp + indexed + std::max(errors, saving);
+}
+
+//rough peak memory of a whole job from the header of its input, from decoding to saving
+inline size_t job_memory(const dither::image_header header, const dither_args a)
+{
+	const unsigned bpp = a.alpha_threshold!="" && (header.bpp==2 || header.bpp==4) ? 4 : 3;
+	const size_t source = static_cast<size_t>(header.width)*header.height;
+
+	const auto [width, height] = target_size(header.width, header.height, a);
+
+	//the decoded image, it converted and the ditherers copy getting resized
+	const size_t loading = source*(header.bpp+bpp*2);
+
+	//a pyramid also keeps the level being resized for the next one
+	const size_t pyramid = a.total.find(',')!=std::string::npos ? source*bpp : 0;
+
+	return loading + pyramid + level_memory(width, height, bpp, a);
+}
+
+//turns on rolling errors if thats the only way the job fits the budget, returns how much it should reserve
+//jobs with an unreadable header reserve the whole budget so they run alone
+inline size_t plan_memory(const std::filesystem::path path, dither_args& a, const dither::memory_budget& budget)
+{
+	dither::image_header header;
+	if(!dither::read_header(path, header))
+		return budget.limit();
+
+	const size_t full = job_memory(header, a);
+	if(budget.fits(full))
+		return full;
+
+	dither_args rolling_args = a;
+	rolling_args.rolling_errors = "1";
+
+	const size_t rolling = job_memory(header, rolling_args);
+	if(rolling < full)
+	{
+		a.rolling_errors = rolling_args.rolling_errors;
+		return rolling;
+	}
+
+	return full;
+}
+
+//true if alpha_threshold is empty (no alpha) or a number from 0 to 255
+inline bool valid_alpha_threshold(const std::string alpha_threshold)
+{
+	if(alpha_threshold=="")
+		return true;
+
+	if(alpha_threshold.size()>3 || !std::all_of(alpha_threshold.begin(), alpha_threshold.end(),
+		[](const char c){return std::isdigit(static_cast<unsigned char>(c));}))
+		return false;
+
+	return std::stoi(alpha_threshold)<=255;
+}
+
+//throws if the output format cant hold the dithered image, so that gets found out before dithering it
+inline void check_output(const dither_args a, const size_t colors_amount, const bool has_alpha)
+{
+	if(a.format=="pbm" && (colors_amount!=2 || has_alpha))
+		throw std::runtime_error("pbm output needs a two color palette without transparency");
+
+	//transparent pixels take a palette entry of their own
+	if(a.format=="indexed" && colors_amount+(has_alpha ? 1 : 0) > 256)
+		throw std::runtime_error("indexed output fits 256 colors, with transparency thats 255 colors and a transparent one");
+}
+
+template<typename T>
+void resize_generic(T& d, const dither_args a)
+{
+	if(a.alpha_threshold!="")
+		d.set_alpha_threshold(std::stoi(a.alpha_threshold));
+
+	d.set_rolling_errors(a.rolling_errors!="");
+
+	if(a.width!="" || a.height!="")
+	{
+		const unsigned d_width = a.width=="" ? d.width() : std::stoi(a.width);
+		const unsigned d_height = a.height=="" ? d.height() : std::stoi(a.height);
+
+		d.resize(d_width, d_height);
+	} else if(a.total!="")
+	{
+		d.resize_total(std::stoi(a.total));
+	}
+}
+
+inline void save_png(const dither::indexed_image& img, std::ostream& out, const png::encode_options options)
+{
+	const trace::scope trace_scope("save");
+
+	const yconv::image expanded = img.expand();
+
+	const png::image_info info{img.width(), img.height(), 8, img.has_alpha() ? png::color_type::rgba : png::color_type::rgb};
+	png::write(out, info, expanded.data.data(), options);
+}
+
+inline void save_indexed_png(const dither::indexed_image& img, std::ostream& out, const png::encode_options options)
+{
+	const trace::scope trace_scope("save");
+
+	//transparent pixels get their own fully transparent palette entry after the colors
+	const size_t palette_size = img.colors().size()+(img.has_alpha() ? 1 : 0);
+
+	png::image_info info{img.width(), img.height(), png::indexed_depth(palette_size), png::color_type::indexed};
+
+	info.palette.reserve(palette_size*3);
+	for(const auto& c : img.colors())
+	{
+		info.palette.push_back(c.r);
+		info.palette.push_back(c.g);
+		info.palette.push_back(c.b);
+	}
+
+	if(img.has_alpha())
+	{
+		info.palette.insert(info.palette.end(), {0, 0, 0});
+
+		info.palette_alpha.resize(palette_size, 255);
+		info.palette_alpha.back() = 0;
+	}
+
+	const std::vector<uint8_t> packed = png::pack_indices(img.data().data(), img.width(), img.height(), info.bit_depth);
+	png::write(out, info, packed.data(), options);
+}
+
+//packed is rows of 1 bit per pixel, set bits being the second color
+inline void save_bilevel(const std::vector<uint8_t>& packed, const unsigned width, const unsigned height,
+	const dither::colors_base& colors, const size_t dark_index, const dither_args a)
+{
+	const trace::scope trace_scope("save");
+
+	std::ofstream out_file;
+	std::ostream& out = open_output(a, format_extension(a.format), out_file);
+
+	if(a.format=="pbm")
+	{
+		//pbm has no palette, set bits are black so theyre flipped if the second color is the lighter one
+		const size_t row_bytes = (width+7)/8;
+		const uint8_t flip = dark_index==1 ? 0 : 0xff;
+
+		//padding bits at the end of a row stay clear
+		const uint8_t last_mask = width%8==0 ? 0xff : static_cast<uint8_t>(0xff<<(8-width%8));
+
+		std::vector<uint8_t> row(row_bytes);
+
+		out << "P4\n" << width << ' ' << height << '\n';
+		for(unsigned y = 0; y < height; ++y)
+		{
+			for(size_t i = 0; i < row_bytes; ++i)
+				row[i] = packed[y*row_bytes+i]^flip;
+
+			row.back() &= last_mask;
+
+			out.write(reinterpret_cast<const char*>(row.data()), row_bytes);
+		}
+	} else
+	{
+		png::image_info info{width, height, 1, png::color_type::indexed};
+		for(const auto& c : colors)
+			info.palette.insert(info.palette.end(), {static_cast<uint8_t>(c.r), static_cast<uint8_t>(c.g), static_cast<uint8_t>(c.b)});
+
+		png::write(out, info, packed.data(), png_options(a));
+	}
+
+	//so whatever reads a stream of them gets each image as soon as its done
+	out.flush();
+}
+
+inline void save_generic(const dither::indexed_image& img, const dither_args a)
+{
+	if(a.format=="pbm")
+	{
+		if(img.colors().size()!=2 || img.has_alpha())
+			throw std::runtime_error("pbm output needs a two color palette without transparency");
+
+		const std::vector<uint8_t> packed = png::pack_indices(img.data().data(), img.width(), img.height(), 1);
+
+		const auto& c = img.colors();
+		const size_t dark_index = c[1].r*299+c[1].g*587+c[1].b*114 < c[0].r*299+c[0].g*587+c[0].b*114 ? 1 : 0;
+
+		save_bilevel(packed, img.width(), img.height(), c, dark_index, a);
+
+		return;
+	}
+
+	std::ofstream out_file;
+	std::ostream& out = open_output(a, format_extension(a.format), out_file);
+
+	if(a.format=="" || a.format=="png")
+	{
+		save_png(img, out, png_options(a));
+	} else if(a.format=="indexed")
+	{
+		save_indexed_png(img, out, png_options(a));
+	} else if(a.format=="ppm" || a.format=="pam")
+	{
+		stream::write_netpbm(out, img.expand(), a.format=="pam");
+	} else if(a.format=="raw")
+	{
+		const trace::scope trace_scope("save");
+
+		//the indices as theyre stored, one byte each or two little endian ones over 256 colors
+		out.write(reinterpret_cast<const char*>(img.data().data()), img.data().size());
+	} else
+	{
+		throw std::runtime_error(std::string("unknown output format: ") + a.format);
+	}
+
+	out.flush();
+}
+
+template<typename T>
+void dither_generic(T& d, const dither_args a)
+{
+	using namespace dither;
+
+	resize_generic(d, a);
+
+	check_output(a, d.colors().size(), d.image().bpp==4);
+
+	const auto type = ditherer_base::parse_type(a.dither_type);
+
+	//two colors going into a bit packed output dont need the generic ditherer at all if picking them
+	//by luminance is fine, its asked for since it ignores the distance function
+	const bool packed_output = a.format=="pbm" || a.format=="indexed";
+	if(a.bilevel!="" && packed_output && a.alpha_threshold=="" && bilevel_ditherer::suitable(d.colors()))
+	{
+		const bilevel_ditherer bilevel(d.image(), d.colors());
+		save_bilevel(bilevel.dither(type), bilevel.width(), bilevel.height(), bilevel.colors(), bilevel.dark_index(), a);
+
+		return;
+	}
+
+	save_generic(d.dither(type), a);
+}
+
+//dithers straight to text, each palette index maps to its text without an intermediate image
+template<typename T>
+void dither_text(T& d, const dither_args a, const totext::replace_pairs pairs)
+{
+	using namespace dither;
+
+	std::vector<totext::color> text_colors;
+	text_colors.reserve(d.colors().size());
+	for(const auto& c : d.colors())
+		text_colors.push_back(totext::color{static_cast<uint8_t>(c.r), static_cast<uint8_t>(c.g), static_cast<uint8_t>(c.b)});
+
+	totext::index_tokens tokens = totext::converter::index_table(text_colors, pairs);
+
+	//transparent pixels
+	tokens.push_back(" ");
+
+	resize_generic(d, a);
+
+	std::ofstream out_file;
+	std::ostream& out_text = open_output(a, ".txt", out_file);
+
+	d.dither_indexed(ditherer_base::parse_type(a.dither_type), [&](const int x, const int y, const size_t index)
+	{
+		if(x==0 && y!=0)
+			out_text << '\n';
+
+		out_text << tokens[index];
+	});
+
+	//lines of the next text in a stream start on their own line
+	if(a.save_path=="-")
+		out_text << std::endl;
+}
+
+//true if the total option lists several sizes
+inline bool is_pyramid(const dither_args a)
+{
+	return a.total.find(',')!=std::string::npos;
+}
+
+//decodes once and dithers every size listed in the total option, each level is downscaled
+//from the previous (bigger) one and dithered concurrently while the next one is being resized
+//level_func(level, level_args) gets called with an already resized ditherer
+//
+//with a budget the first level uses the memory reserved for the whole job and every other level
+//has to get its own, if it cant the level waits for the ones already going to finish instead
+template<typename T, typename F>
+void pyramid_generic(T& d, const dither_args a, F level_func, dither::memory_budget* budget = nullptr)
+{
+	std::vector<unsigned> totals;
+
+	std::stringstream totals_stream(a.total);
+	std::string total;
+	while(std::getline(totals_stream, total, ','))
+		totals.push_back(std::stoi(total));
+
+	std::sort(totals.begin(), totals.end(), std::greater<unsigned>());
+	totals.erase(std::unique(totals.begin(), totals.end()), totals.end());
+
+	std::vector<std::future<void>> levels;
+	levels.reserve(totals.size());
+
+	T level = d;
+	for(const unsigned level_total : totals)
+	{
+		level.resize_total(level_total);
+
+		dither_args level_args = a;
+		level_args.total = "";
+		level_args.save_path = a.save_path + "_" + std::to_string(level_total);
+
+		std::unique_ptr<dither::memory_budget::reservation> reserved;
+		if(budget!=nullptr && !levels.empty())
+		{
+			const size_t level_bytes = level_memory(level.width(), level.height(), level.image().bpp, level_args);
+			if(budget->try_acquire(level_bytes))
+			{
+				reserved = std::make_unique<dither::memory_budget::reservation>(*budget, level_bytes, std::adopt_lock);
+			} else
+			{
+				for(auto& l : levels)
+					l.get();
+
+				levels.clear();
+			}
+		}
+
+		levels.emplace_back(std::async(std::launch::async,
+			[level, level_args, &level_func, reserved = std::move(reserved)]() mutable
+		{
+			level_func(level, level_args);
+		}));
+	}
+
+	for(auto& l : levels)
+		l.get();
+}
+
+//dithers every frame next_frame(index, frame) gives (until it returns false) with the same palette,
+//each frame only redoes what changed since the previous one, save_path(index) is where a frame goes
+template<class T_color, typename N, typename P>
+void sequence_generic(N next_frame, P save_path, const std::shared_ptr<const dither::palette<T_color>> colors_palette,
+	const dither_args a)
+{
+	using namespace dither;
+
+	sequence_ditherer<T_color> sequence(ditherer_base::parse_type(a.dither_type));
+
+	yconv::image frame;
+	for(size_t i = 0; next_frame(i, frame); ++i)
+	{
+		const trace::scope trace_scope("frame");
+
+		ditherer<T_color> frame_ditherer(std::move(frame), colors_palette);
+		resize_generic(frame_ditherer, a);
+
+		check_output(a, colors_palette->colors().size(), frame_ditherer.image().bpp==4);
+
+		dither_args frame_args = a;
+		frame_args.save_path = save_path(i);
+
+		save_generic(sequence.next(frame_ditherer), frame_args);
+	}
+}
+
+#endif
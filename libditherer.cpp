@@ -0,0 +1,243 @@
+#include <string>
+#include <cstring>
+#include <memory>
+
+#include "dither.h"
+#include "preview.h"
+#include "libditherer.h"
+
+
+using namespace dither;
+
+struct ditherer_palette
+{
+	std::string distance;
+	std::shared_ptr<const palette_base> colors;
+};
+
+struct ditherer_preview
+{
+	std::string distance;
+
+	//a preview_ditherer of the distance functions color type
+	std::shared_ptr<void> previewer;
+};
+
+namespace
+{
+	thread_local std::string last_error = "";
+
+	std::string distance_name(const ditherer_distance distance)
+	{
+		switch(distance)
+		{
+			case DITHERER_DISTANCE_RGB:
+				return "RGB";
+
+			case DITHERER_DISTANCE_LAB:
+				return "LAB";
+
+			case DITHERER_DISTANCE_XYZ:
+				return "XYZ";
+
+			case DITHERER_DISTANCE_CIE94:
+				return "CIE94";
+
+			case DITHERER_DISTANCE_CIEDE2000:
+				return "CIEDE2000";
+
+			default:
+				throw std::runtime_error(std::string("unknown distance function: ") + std::to_string(distance));
+		}
+	}
+
+	//copies rows that are stride bytes apart into a tightly packed image
+	yconv::image packed_image(const uint8_t* input, const unsigned width, const unsigned height, const unsigned bpp,
+		const size_t input_stride)
+	{
+		if(bpp!=3 && bpp!=4)
+			throw std::runtime_error(std::string("cant dither image with bits per pixel value: ") + std::to_string(bpp));
+
+		const size_t row_size = width*bpp;
+		if(input_stride < row_size)
+			throw std::runtime_error("stride is smaller than a row");
+
+		std::vector<uint8_t> data(row_size*height);
+		for(unsigned y = 0; y < height; ++y)
+			std::memcpy(data.data()+y*row_size, input+y*input_stride, row_size);
+
+		return yconv::image(width, height, bpp, std::move(data));
+	}
+
+	ditherer_base::dither_type kernel_type(const ditherer_kernel kernel)
+	{
+		switch(kernel)
+		{
+			case DITHERER_FLOYD_STEINBERG:
+				return ditherer_base::dither_type::floyd_steinberg;
+
+			case DITHERER_ATKINSON:
+				return ditherer_base::dither_type::atkinson;
+
+			case DITHERER_JARVIS:
+				return ditherer_base::dither_type::jarvis;
+
+			case DITHERER_ORDERED:
+				return ditherer_base::dither_type::ordered;
+
+			default:
+				throw std::runtime_error(std::string("unknown dither type: ") + std::to_string(kernel));
+		}
+	}
+}
+
+ditherer_palette* ditherer_palette_create(const uint8_t* colors, size_t colors_amount, ditherer_distance distance)
+{
+	try
+	{
+		if(colors==nullptr || colors_amount==0)
+			throw std::runtime_error("palette needs at least one color");
+
+		colors_base parsed_colors;
+		parsed_colors.reserve(colors_amount);
+
+		for(size_t i = 0; i < colors_amount; ++i)
+			parsed_colors.emplace_back(colors[i*3], colors[i*3+1], colors[i*3+2]);
+
+		auto created = std::make_unique<ditherer_palette>(ditherer_palette{distance_name(distance), nullptr});
+
+		with_distance(created->distance, [&](auto c)
+		{
+			created->colors = std::make_shared<const palette<decltype(c)>>(parsed_colors);
+		});
+
+		return created.release();
+	} catch(const std::exception& e)
+	{
+		last_error = e.what();
+		return nullptr;
+	}
+}
+
+void ditherer_palette_destroy(ditherer_palette* palette)
+{
+	delete palette;
+}
+
+int ditherer_dither(const ditherer_palette* palette, ditherer_kernel kernel,
+	const uint8_t* input, unsigned width, unsigned height, unsigned bpp, size_t input_stride,
+	uint8_t* output, size_t output_stride)
+{
+	try
+	{
+		if(palette==nullptr || input==nullptr || output==nullptr)
+			throw std::runtime_error("null argument");
+
+		if(output_stride < static_cast<size_t>(width)*bpp)
+			throw std::runtime_error("stride is smaller than a row");
+
+		//moved along from here instead of getting copied at every step
+		yconv::image img = packed_image(input, width, height, bpp, input_stride);
+		const auto type = kernel_type(kernel);
+
+		with_distance(palette->distance, [&](auto c)
+		{
+			typedef decltype(c) color_type;
+
+			const ditherer<color_type> c_dither(std::move(img),
+				std::static_pointer_cast<const dither::palette<color_type>>(palette->colors));
+
+			c_dither.dither(type, output, output_stride);
+		});
+
+		return 0;
+	} catch(const std::exception& e)
+	{
+		last_error = e.what();
+		return -1;
+	}
+}
+
+ditherer_preview* ditherer_preview_create(const uint8_t* input, unsigned width, unsigned height, unsigned bpp,
+	size_t input_stride, unsigned preview_width, unsigned preview_height, ditherer_kernel kernel,
+	unsigned latency_ms, ditherer_distance distance)
+{
+	try
+	{
+		if(input==nullptr)
+			throw std::runtime_error("null argument");
+
+		auto created = std::make_unique<ditherer_preview>(ditherer_preview{distance_name(distance), nullptr});
+
+		yconv::image img = packed_image(input, width, height, bpp, input_stride);
+		const auto type = kernel_type(kernel);
+
+		with_distance(created->distance, [&](auto c)
+		{
+			created->previewer = std::make_shared<preview_ditherer<decltype(c)>>(std::move(img),
+				preview_width, preview_height, type, std::chrono::milliseconds(latency_ms));
+		});
+
+		return created.release();
+	} catch(const std::exception& e)
+	{
+		last_error = e.what();
+		return nullptr;
+	}
+}
+
+void ditherer_preview_destroy(ditherer_preview* preview)
+{
+	delete preview;
+}
+
+int ditherer_preview_render(ditherer_preview* preview, const ditherer_palette* palette,
+	ditherer_preview_callback callback, void* user_data)
+{
+	try
+	{
+		if(preview==nullptr || palette==nullptr || callback==nullptr)
+			throw std::runtime_error("null argument");
+
+		if(preview->distance!=palette->distance)
+			throw std::runtime_error(std::string("palette is for the ") + palette->distance
+				+ " distance function, the preview uses " + preview->distance);
+
+		bool finished = false;
+		with_distance(preview->distance, [&](auto c)
+		{
+			typedef decltype(c) color_type;
+
+			auto& previewer = *std::static_pointer_cast<preview_ditherer<color_type>>(preview->previewer);
+
+			finished = previewer.render(std::static_pointer_cast<const dither::palette<color_type>>(palette->colors),
+				[&](const indexed_image& result, const bool final)
+			{
+				const yconv::image expanded = result.expand();
+				callback(expanded.data.data(), expanded.width, expanded.height, expanded.bpp, final ? 1 : 0, user_data);
+			});
+		});
+
+		return finished ? 0 : 1;
+	} catch(const std::exception& e)
+	{
+		last_error = e.what();
+		return -1;
+	}
+}
+
+void ditherer_preview_cancel(ditherer_preview* preview)
+{
+	if(preview==nullptr)
+		return;
+
+	with_distance(preview->distance, [&](auto c)
+	{
+		std::static_pointer_cast<preview_ditherer<decltype(c)>>(preview->previewer)->cancel();
+	});
+}
+
+const char* ditherer_last_error(void)
+{
+	return last_error.c_str();
+}
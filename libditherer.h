@@ -0,0 +1,71 @@
+#ifndef YAN_LIBDITHERER_H
+#define YAN_LIBDITHERER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct ditherer_palette ditherer_palette;
+
+typedef enum
+{
+	DITHERER_DISTANCE_RGB,
+	DITHERER_DISTANCE_LAB,
+	DITHERER_DISTANCE_XYZ,
+	DITHERER_DISTANCE_CIE94,
+	DITHERER_DISTANCE_CIEDE2000
+} ditherer_distance;
+
+typedef enum
+{
+	DITHERER_FLOYD_STEINBERG,
+	DITHERER_ATKINSON,
+	DITHERER_JARVIS,
+	DITHERER_ORDERED
+} ditherer_kernel;
+
+/* colors is colors_amount packed RGB triplets, returns NULL on failure */
+ditherer_palette* ditherer_palette_create(const uint8_t* colors, size_t colors_amount, ditherer_distance distance);
+void ditherer_palette_destroy(ditherer_palette* palette);
+
+/* dithers a 3 (RGB) or 4 (RGBA, alpha is copied) bytes per pixel image into output
+   which must hold height rows of output_stride bytes, returns 0 on success */
+int ditherer_dither(const ditherer_palette* palette, ditherer_kernel kernel,
+	const uint8_t* input, unsigned width, unsigned height, unsigned bpp, size_t input_stride,
+	uint8_t* output, size_t output_stride);
+
+typedef struct ditherer_preview ditherer_preview;
+
+/* called with a rendered preview, pixels are width*height pixels of the bpp the preview was created with,
+   final is 0 for the quick result that comes first and 1 for the full one */
+typedef void (*ditherer_preview_callback)(const uint8_t* pixels, unsigned width, unsigned height, unsigned bpp,
+	int final, void* user_data);
+
+/* keeps an image resized to preview_width and preview_height (0 keeps that side) for previewing it with
+   palettes that keep changing, the quick result of every render takes about latency_ms, returns NULL on failure */
+ditherer_preview* ditherer_preview_create(const uint8_t* input, unsigned width, unsigned height, unsigned bpp,
+	size_t input_stride, unsigned preview_width, unsigned preview_height, ditherer_kernel kernel,
+	unsigned latency_ms, ditherer_distance distance);
+void ditherer_preview_destroy(ditherer_preview* preview);
+
+/* renders with a palette of the same distance function, calling callback with the quick and the full result,
+   starting another render (from any thread) or cancelling stops this one,
+   returns 0 when it finished, 1 if it got stopped and -1 on failure */
+int ditherer_preview_render(ditherer_preview* preview, const ditherer_palette* palette,
+	ditherer_preview_callback callback, void* user_data);
+
+/* stops the render in progress if theres one */
+void ditherer_preview_cancel(ditherer_preview* preview);
+
+/* message of the last failure on the calling thread */
+const char* ditherer_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
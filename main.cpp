@@ -1,63 +1,78 @@
 #include <iostream>
+#include <fstream>
 #include <filesystem>
+#include <thread>
+#include <sstream>
+#include <memory>
+#include <atomic>
 
-#include <unistd.h>
+#include <getopt.h>
 
-#include "dither.h"
+#include "job.h"
+#include "server.h"
+#include "cache.h"
+#include "generic.h"
+#include "preview.h"
 
 
 void help_message(const char* exec_path)
 {
-	std::cout << "usage: " << exec_path << " [args] /path/to/image\n\n";
+	std::cout << "usage: " << exec_path << " [args] /path/to/image [/path/to/more/images ...]\n";
+	std::cout << "       " << exec_path << " [args] - (reads ppm, pgm, pam or png images from stdin)\n";
+	std::cout << "       " << exec_path << " [args] -S /path/to/frame_list\n";
+	std::cout << "       " << exec_path << " --serve /path/to/socket\n\n";
 	std::cout << "args:\n";
 	std::cout << "	-c		comma separated list of RGB colors\n";
 	std::cout << "	-C		path to a comma separated list of RGB colors\n";
 	std::cout << "	-x		desired width (default same)\n";
 	std::cout << "	-y		desired height (default same)\n";
 	std::cout << "	-t		desired total amount of pixels (incompatable with -w and -h options) (default same)\n";
+	std::cout << "			a comma separated list outputs every size (as image_name_total.png)\n";
 	std::cout << "	-d		distance function (default LAB)\n";
 	std::cout << "	-D		dithering function (default jarvis)\n";
-	std::cout << "	-o		output path (default ./image_name.png)\n";
+	std::cout << "	-o		output path (default ./image_name.png), with several images they get numbered (output_path_n.png)\n";
+	std::cout << "			- writes to stdout (every frame of a sequence one after another), which is the default for images from stdin\n";
+	std::cout << "	-a		keep the alpha channel, pixels with alpha under this value (0-255) are left transparent\n";
+	std::cout << "	-f		output format (default png)\n";
+	std::cout << "	-z		png compression level, 0-9 (default 6)\n";
+	std::cout << "	-F		png filter (default automatic)\n";
+	std::cout << "	-S		path to a list of frames (one per line) to dither as a sequence, only the parts\n";
+	std::cout << "			that changed since the previous frame get redone (outputs output_path_frame.png)\n";
+	std::cout << "	-T		path to color replace config, outputs text instead of an image (see totext)\n";
+	std::cout << "	--serve		listen for dither requests on a unix socket\n";
+	std::cout << "	--trace		path to write a chrome/perfetto trace of the run to\n";
+	std::cout << "	--cache		directory to cache outputs in, repeated jobs get copied from it\n";
+	std::cout << "	--cache-size	maximum size of the cache in megabytes (default 1024)\n";
+	std::cout << "	--mem-limit	megabytes of memory concurrent jobs (several images, pyramid levels, server requests)\n";
+	std::cout << "			can use together, jobs that dont fit wait and big ones keep fewer errors around (default no limit)\n";
+	std::cout << "	--stats		print how the nearest color searches went to stderr\n";
+	std::cout << "	--bilevel	dither two color palettes going to pbm or indexed output by luminance alone,\n";
+	std::cout << "			a lot faster but ignores the distance function\n";
+	std::cout << "	--preview	path to a list of palettes (one per line, - reads them from stdin as theyre edited),\n";
+	std::cout << "			renders a quick and a full preview with each (output_path_n_quick and output_path_n),\n";
+	std::cout << "			-c/-C being palette 0, a new palette stops the render in progress and an empty line cancels it\n";
 	std::cout << "\n\ndistance functions:\n";
-	std::cout << "	RGB, LAB, XYZ";
+	std::cout << "	RGB, LAB, XYZ, CIE94, CIEDE2000 (the last two are perceptual color differences, slower than the rest)";
 	std::cout << "\n\ndithering functions:\n";
 	std::cout << "	floyd_steinberg, atkinson, jarvis, ordered\n";
+	std::cout << "\n\noutput formats:\n";
+	std::cout << "	png		truecolor png\n";
+	std::cout << "	indexed		palettized png with the smallest bit depth that fits the palette\n";
+	std::cout << "	pbm		1 bit netpbm image, needs a two color palette (the darker color is black)\n";
+	std::cout << "	ppm		truecolor netpbm image without alpha\n";
+	std::cout << "	pam		truecolor netpbm image with alpha\n";
+	std::cout << "	raw		palette indices, one byte per pixel (two little endian bytes over 256 colors), no header\n";
+	std::cout << "\n\npng filters:\n";
+	std::cout << "	automatic (none for indexed, adaptive otherwise), none, sub, up, average, paeth, adaptive\n";
 	std::cout << "\n\ncolors list example:\n";
 	std::cout << "	255, 255, 255, 0, 0, 0, 255, 0, 0, 127, 127, 0\n";
-	std::cout << "	{255, 255, 255}, {0, 0, 0}, {255, 0, 0}, {127, 127, 0}";
+	std::cout << "	{255, 255, 255}, {0, 0, 0}, {255, 0, 0}, {127, 127, 0}\n";
+	std::cout << "\n\nserver requests (one per line, tab separated key=value fields):\n";
+	std::cout << "	input, colors, colors_path, distance, dither, width, height, total, output, format, png_level, png_filter, alpha_threshold, bilevel\n";
+	std::cout << "	replies with \"ok output_path\" or \"error message\", connections idle for a minute get closed";
 	std::cout << std::endl;
 }
 
-struct dither_args
-{
-	std::string width = "";
-	std::string height = "";
-	std::string total = "";
-	std::string dither_type = "";
-	std::string save_path = "";
-};
-
-template<typename T>
-void dither_generic(T& d, const dither_args a)
-{
-	using namespace dither;
-
-	if(a.width!="" || a.height!="")
-	{
-		const unsigned d_width = a.width=="" ? d.width() : std::stoi(a.width);
-		const unsigned d_height = a.height=="" ? d.height() : std::stoi(a.height);
-
-		d.resize(d_width, d_height);
-	} else if(a.total!="")
-	{
-		d.resize_total(std::stoi(a.total));
-	}
-
-	const yconv::image img = d.dither(ditherer_base::parse_type(a.dither_type));
-
-	img.save(a.save_path+std::string(".png"));
-}
-
 int main(int argc, char* argv[])
 {
     std::string argument_colors = "";
@@ -68,6 +83,32 @@ int main(int argc, char* argv[])
 	std::string argument_compare_func = "LAB";
 	std::string argument_dithering_func = "jarvis";
 	std::string argument_output_path = "";
+	std::string argument_alpha_threshold = "";
+	std::string argument_format = "";
+	std::string argument_png_level = "";
+	std::string argument_png_filter = "";
+	std::string argument_text_path = "";
+	std::string argument_sequence_path = "";
+	std::string argument_serve_path = "";
+	std::string argument_trace_path = "";
+	std::string argument_cache_path = "";
+	std::string argument_cache_size = "1024";
+	std::string argument_mem_limit = "0";
+	bool argument_stats = false;
+	std::string argument_bilevel = "";
+	std::string argument_preview_path = "";
+
+	enum long_option{serve_option = 256, trace_option, cache_option, cache_size_option, mem_limit_option, stats_option, bilevel_option, preview_option};
+	const option long_options[] = {
+		{"serve", required_argument, nullptr, long_option::serve_option},
+		{"trace", required_argument, nullptr, long_option::trace_option},
+		{"cache", required_argument, nullptr, long_option::cache_option},
+		{"cache-size", required_argument, nullptr, long_option::cache_size_option},
+		{"mem-limit", required_argument, nullptr, long_option::mem_limit_option},
+		{"stats", no_argument, nullptr, long_option::stats_option},
+		{"bilevel", no_argument, nullptr, long_option::bilevel_option},
+		{"preview", required_argument, nullptr, long_option::preview_option},
+		{nullptr, 0, nullptr, 0}};
 
     if(argc==1)
 	{
@@ -77,7 +118,7 @@ int main(int argc, char* argv[])
 
 	while(true)
 	{
-		switch(getopt(argc, argv, "c:C:x:y:ht:d:D:o:"))
+		switch(getopt_long(argc, argv, "c:C:x:y:ht:d:D:o:a:f:z:F:S:T:", long_options, nullptr))
 		{
 			case 'c':
 				argument_colors = std::string(optarg);
@@ -111,6 +152,62 @@ int main(int argc, char* argv[])
 				argument_output_path = std::string(optarg);
 				continue;
 
+			case 'a':
+				argument_alpha_threshold = std::string(optarg);
+				continue;
+
+			case 'f':
+				argument_format = std::string(optarg);
+				continue;
+
+			case 'z':
+				argument_png_level = std::string(optarg);
+				continue;
+
+			case 'F':
+				argument_png_filter = std::string(optarg);
+				continue;
+
+			case 'S':
+				argument_sequence_path = std::string(optarg);
+				continue;
+
+			case 'T':
+				argument_text_path = std::string(optarg);
+				continue;
+
+			case long_option::serve_option:
+				argument_serve_path = std::string(optarg);
+				continue;
+
+			case long_option::trace_option:
+				argument_trace_path = std::string(optarg);
+				continue;
+
+			case long_option::cache_option:
+				argument_cache_path = std::string(optarg);
+				continue;
+
+			case long_option::cache_size_option:
+				argument_cache_size = std::string(optarg);
+				continue;
+
+			case long_option::mem_limit_option:
+				argument_mem_limit = std::string(optarg);
+				continue;
+
+			case long_option::stats_option:
+				argument_stats = true;
+				continue;
+
+			case long_option::bilevel_option:
+				argument_bilevel = "1";
+				continue;
+
+			case long_option::preview_option:
+				argument_preview_path = std::string(optarg);
+				continue;
+
 			case 'h':
 				help_message(argv[0]);
 				return 3;
@@ -121,6 +218,42 @@ int main(int argc, char* argv[])
 		break;
 	}
 
+	if(argument_trace_path!="")
+		trace::enable();
+
+	//everything thats left to do after a run went fine
+	const auto finish = [&]()
+	{
+		if(argument_stats)
+		{
+			const dither::search_counters totals = dither::search_totals();
+			const double searches = std::max<uint64_t>(1, totals.searches);
+
+			std::cerr << "color searches: " << totals.searches
+				<< ", previous color won: " << 100*totals.previous_won/searches << "%"
+				<< ", colors measured per search: " << totals.entries/searches
+				<< ", skipped per search: " << totals.entries_skipped/searches
+				<< std::endl;
+		}
+
+		if(argument_trace_path!="")
+			trace::save(argument_trace_path);
+	};
+
+	const size_t memory_limit = std::stoull(argument_mem_limit)*1024*1024;
+
+	if(argument_serve_path!="")
+	{
+		{
+			dither::server d_server(argument_serve_path, std::max(1u, std::thread::hardware_concurrency()), memory_limit);
+			d_server.run();
+		}
+
+		finish();
+
+		return 0;
+	}
+
 	if(argument_colors=="" && argument_colors_path=="")
 	{
 		std::cout << "-c or -C options are mandatory!!" << std::endl;
@@ -135,14 +268,29 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
-	if(optind >= argc)
+	if(!valid_alpha_threshold(argument_alpha_threshold))
+	{
+		std::cout << "alpha threshold has to be between 0 and 255!!" << std::endl;
+		help_message(argv[0]);
+		return 1;
+	}
+
+	if(argument_sequence_path!="")
+	{
+		if(argument_text_path!="" || is_pyramid(dither_args{"", "", argument_total}))
+		{
+			std::cout << "cant use -S with -T or several -t sizes!!" << std::endl;
+			help_message(argv[0]);
+			return 1;
+		}
+	} else if(optind >= argc)
 	{
 		std::cout << "path to image not given!!" << std::endl;
 		help_message(argv[0]);
 		return 1;
 	}
 
-	const std::filesystem::path image_path{argv[optind]};
+	const std::filesystem::path image_path{argument_sequence_path!="" ? argument_sequence_path : argv[optind]};
 
 	std::string save_path;
 	if(argument_output_path!="")
@@ -151,35 +299,361 @@ int main(int argc, char* argv[])
 		save_path = image_path.stem().string();
 
 	const dither_args d_args
-		{argument_width, argument_height, argument_total, argument_dithering_func, save_path};
+		{argument_width, argument_height, argument_total, argument_dithering_func, save_path, argument_format,
+		argument_png_level, argument_png_filter, argument_alpha_threshold, argument_bilevel};
 
 
 	using namespace dither;
 
-	const colors_base dither_colors = argument_colors_path=="" ?
-		parser::parse_colors(argument_colors)
-		: parser::parse_colors(std::filesystem::path(argument_colors_path));
-
-	yconv::image img{image_path};
-	img.bpp_resize(3);
-	if(argument_compare_func=="RGB")
+	colors_base dither_colors;
+	try
 	{
-		ditherer<color<int>> c_dither(img, dither_colors);
-		dither_generic(c_dither, d_args);
-	} else if(argument_compare_func=="LAB")
+		dither_colors = argument_colors_path=="" ?
+			parser::parse_colors(argument_colors)
+			: parser::parse_colors(std::filesystem::path(argument_colors_path));
+	} catch(const std::exception& e)
 	{
-		ditherer<color_lab> c_dither(img, dither_colors);
-		dither_generic(c_dither, d_args);
-	} else if(argument_compare_func=="XYZ")
+		std::cout << "cant read the palette: " << e.what() << std::endl;
+		return 1;
+	}
+
+	if(argument_sequence_path!="")
 	{
-		ditherer<color_xyz> c_dither(img, dither_colors);
-		dither_generic(c_dither, d_args);
-	} else
+		std::vector<std::filesystem::path> frames;
+		std::vector<std::string> frame_save_paths;
+
+		std::stringstream frames_stream(generic::parse_file(argument_sequence_path));
+		std::string frame;
+		while(std::getline(frames_stream, frame))
+		{
+			if(frame=="")
+				continue;
+
+			frames.emplace_back(frame);
+
+			//numbered after the output path if its given (all of them to stdout for -), otherwise named after each frame
+			if(argument_output_path=="-")
+				frame_save_paths.push_back(argument_output_path);
+			else
+				frame_save_paths.push_back(argument_output_path!="" ?
+					argument_output_path + "_" + std::to_string(frames.size()-1)
+					: frames.back().stem().string());
+		}
+
+		const bool known_distance = with_distance(argument_compare_func, [&](auto c)
+		{
+			typedef decltype(c) color_type;
+
+			const auto next_frame = [&](const size_t index, yconv::image& frame)
+			{
+				if(index >= frames.size())
+					return false;
+
+				frame = load_image(frames[index], argument_alpha_threshold);
+				return true;
+			};
+
+			sequence_generic<color_type>(next_frame, [&](const size_t index){return frame_save_paths[index];},
+				std::make_shared<const palette<color_type>>(dither_colors), d_args);
+		});
+
+		if(!known_distance)
+		{
+			std::cout << "invalid distance function!!!!" << std::endl;
+			help_message(argv[0]);
+			return 3;
+		}
+
+		finish();
+
+		return 0;
+	}
+
+	const totext::replace_pairs text_pairs = argument_text_path=="" ?
+		totext::replace_pairs{}
+		: totext::parser::parse_pairs(std::filesystem::path(argument_text_path));
+
+	if(!with_distance(argument_compare_func, [](auto){}))
 	{
 		std::cout << "invalid distance function!!!!" << std::endl;
 		help_message(argv[0]);
 		return 3;
 	}
 
+	if(save_path=="-" && (is_pyramid(d_args) || argc-optind > 1))
+	{
+		std::cout << "cant write several -t sizes or several images to stdout!!" << std::endl;
+		help_message(argv[0]);
+		return 1;
+	}
+
+	//images from stdin get dithered as they arrive like frames of a sequence
+	if(image_path=="-")
+	{
+		if(is_pyramid(d_args) || argument_cache_path!="")
+		{
+			std::cout << "cant use several -t sizes or --cache with images from stdin!!" << std::endl;
+			help_message(argv[0]);
+			return 1;
+		}
+
+		const auto next_frame = [&](const size_t, yconv::image& frame)
+		{
+			if(!stream::read_image(std::cin, frame))
+				return false;
+
+			convert_image(frame, argument_alpha_threshold);
+			return true;
+		};
+
+		//everything goes to stdout or each frame to its own file numbered after the output path
+		const auto frame_save_path = [&](const size_t index)
+		{
+			return save_path=="-" ? save_path : save_path + "_" + std::to_string(index);
+		};
+
+		with_distance(argument_compare_func, [&](auto c)
+		{
+			typedef decltype(c) color_type;
+
+			const auto colors_palette = std::make_shared<const palette<color_type>>(dither_colors);
+
+			if(argument_text_path=="")
+			{
+				sequence_generic<color_type>(next_frame, frame_save_path, colors_palette, d_args);
+				return;
+			}
+
+			yconv::image frame;
+			for(size_t i = 0; next_frame(i, frame); ++i)
+			{
+				ditherer<color_type> frame_ditherer(std::move(frame), colors_palette);
+
+				dither_args frame_args = d_args;
+				frame_args.save_path = frame_save_path(i);
+
+				dither_text(frame_ditherer, frame_args, text_pairs);
+			}
+		});
+
+		finish();
+
+		return 0;
+	}
+
+	//every palette gets rendered while the next ones are read, a newer one stops the older render
+	if(argument_preview_path!="")
+	{
+		if(argument_total!="" || argument_text_path!="" || argument_cache_path!="" || save_path=="-")
+		{
+			std::cout << "cant use --preview with -t, -T, --cache or -o -!!" << std::endl;
+			help_message(argv[0]);
+			return 1;
+		}
+
+		std::ifstream palettes_file;
+		if(argument_preview_path!="-")
+		{
+			palettes_file.open(argument_preview_path);
+			if(!palettes_file.good())
+				throw std::runtime_error(std::string("cant open palettes list: ") + argument_preview_path);
+		}
+
+		std::istream& palettes = argument_preview_path=="-" ? std::cin : palettes_file;
+
+		with_distance(argument_compare_func, [&](auto c)
+		{
+			typedef decltype(c) color_type;
+
+			preview_ditherer<color_type> previewer(load_image(image_path, ""),
+				argument_width=="" ? 0 : std::stoi(argument_width), argument_height=="" ? 0 : std::stoi(argument_height),
+				ditherer_base::parse_type(argument_dithering_func));
+
+			std::vector<std::thread> renders;
+			const auto render = [&](const size_t index, const colors_base colors)
+			{
+				const auto colors_palette = std::make_shared<const palette<color_type>>(colors);
+
+				renders.emplace_back([&previewer, &d_args, colors_palette, index]()
+				{
+					const bool finished = previewer.render(colors_palette, [&](const indexed_image& result, const bool final)
+					{
+						dither_args preview_args = d_args;
+						preview_args.save_path = d_args.save_path + "_" + std::to_string(index) + (final ? "" : "_quick");
+
+						save_generic(result, preview_args);
+					});
+
+					if(!finished)
+						std::cerr << "preview of palette " << index << " stopped" << std::endl;
+				});
+			};
+
+			render(0, dither_colors);
+
+			size_t index = 1;
+			std::string line;
+			while(std::getline(palettes, line))
+			{
+				if(line=="")
+				{
+					previewer.cancel();
+					continue;
+				}
+
+				colors_base line_colors;
+				try
+				{
+					line_colors = parser::parse_colors(line);
+				} catch(const std::exception& e)
+				{
+					std::cerr << "skipping palette " << index++ << ": " << e.what() << std::endl;
+					continue;
+				}
+
+				render(index++, line_colors);
+			}
+
+			for(auto& r : renders)
+				r.join();
+		});
+
+		finish();
+
+		return 0;
+	}
+
+	std::unique_ptr<result_cache> cache;
+	std::string cache_parameters = "";
+	if(argument_cache_path!="")
+	{
+		cache = std::make_unique<result_cache>(argument_cache_path, std::stoull(argument_cache_size)*1024*1024);
+
+		std::stringstream parameters;
+		parameters << argument_compare_func << '\n' << describe_args(d_args) << '\n';
+
+		for(const auto& c : dither_colors)
+			parameters << c.r << ',' << c.g << ',' << c.b << ';';
+
+		parameters << '\n';
+		for(const auto& [c, text] : text_pairs)
+			parameters << +c.r << ',' << +c.g << ',' << +c.b << '=' << text.size() << ':' << text << ';';
+
+		cache_parameters = parameters.str();
+	}
+
+	memory_budget budget(memory_limit);
+
+	const auto dither_image = [&](const std::filesystem::path image_path, dither_args image_args)
+	{
+		const memory_budget::reservation reserved(budget, plan_memory(image_path, image_args, budget));
+
+		const yconv::image img = load_image(image_path, image_args.alpha_threshold);
+
+		//hashed once, pyramid levels only differ in their parameters
+		const uint64_t image_hash = cache ? result_cache::image_hash(img) : 0;
+
+		with_distance(argument_compare_func, [&](auto c)
+		{
+			ditherer<decltype(c)> c_dither(img, dither_colors);
+
+			const auto output_func = [&](auto& d, const dither_args a)
+			{
+				const std::string extension = argument_text_path!="" ? ".txt" : format_extension(a.format);
+				const std::filesystem::path out_path = a.save_path + extension;
+
+				//pyramid levels are told apart by their (already resized) size
+				const std::string cache_key = cache ?
+					result_cache::key(image_hash, cache_parameters + '\n' + std::to_string(d.width()) + 'x' + std::to_string(d.height()))
+					: "";
+
+				const auto dither_to = [&](const dither_args& out_args)
+				{
+					if(argument_text_path=="")
+						dither_generic(d, out_args);
+					else
+						dither_text(d, out_args, text_pairs);
+				};
+
+				//results for stdout go through a temporary file so they can be stored too
+				if(cache && a.save_path=="-")
+				{
+					if(cache->fetch(cache_key, std::cout))
+						return;
+
+					dither_args temporary_args = a;
+					temporary_args.save_path = cache->temporary_path().string();
+					dither_to(temporary_args);
+
+					const std::filesystem::path temporary = temporary_args.save_path + extension;
+					cache->store(cache_key, temporary);
+
+					std::ifstream temporary_file(temporary, std::ios::binary);
+					std::cout << temporary_file.rdbuf() << std::flush;
+
+					std::filesystem::remove(temporary);
+					return;
+				}
+
+				if(cache && cache->fetch(cache_key, out_path))
+					return;
+
+				dither_to(a);
+
+				if(cache)
+					cache->store(cache_key, out_path);
+			};
+
+			if(is_pyramid(image_args))
+				pyramid_generic(c_dither, image_args, output_func, &budget);
+			else
+				output_func(c_dither, image_args);
+		});
+	};
+
+	const std::vector<std::filesystem::path> images(argv+optind, argv+argc);
+	if(images.size()==1)
+	{
+		dither_image(image_path, d_args);
+	} else
+	{
+		//several images get dithered concurrently, as many as fit in the memory budget at once
+		std::atomic<size_t> next_image = 0;
+		std::atomic<bool> failed = false;
+
+		const auto batch_worker = [&]()
+		{
+			for(size_t i = next_image++; i < images.size(); i = next_image++)
+			{
+				dither_args image_args = d_args;
+				image_args.save_path = argument_output_path!="" ?
+					argument_output_path + "_" + std::to_string(i)
+					: images[i].stem().string();
+
+				try
+				{
+					dither_image(images[i], image_args);
+				} catch(const std::exception& e)
+				{
+					std::cerr << "cant dither " << images[i] << ": " << e.what() << std::endl;
+					failed = true;
+				}
+			}
+		};
+
+		std::vector<std::thread> workers;
+		const size_t workers_amount = std::min<size_t>(images.size(), std::max(1u, std::thread::hardware_concurrency()));
+		for(size_t i = 0; i < workers_amount; ++i)
+			workers.emplace_back(batch_worker);
+
+		for(auto& w : workers)
+			w.join();
+
+		if(failed)
+			return 5;
+	}
+
+	finish();
+
     return 0;
 }
\ No newline at end of file
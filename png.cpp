@@ -0,0 +1,552 @@
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+#include <exception>
+
+#include <zlib.h>
+
+#include "png.h"
+#include "trace.h"
+
+
+using namespace png;
+
+namespace
+{
+	void push_u32(std::vector<uint8_t>& out, const uint32_t value)
+	{
+		out.push_back(value>>24);
+		out.push_back((value>>16)&0xff);
+		out.push_back((value>>8)&0xff);
+		out.push_back(value&0xff);
+	}
+
+	void write_chunk(std::ostream& out, const char* name, const std::vector<uint8_t>& data)
+	{
+		std::vector<uint8_t> chunk;
+		chunk.reserve(data.size()+12);
+
+		push_u32(chunk, data.size());
+		chunk.insert(chunk.end(), name, name+4);
+		chunk.insert(chunk.end(), data.begin(), data.end());
+
+		//crc covers the name and the data but not the length
+		push_u32(chunk, crc32(crc32(0, nullptr, 0), chunk.data()+4, chunk.size()-4));
+
+		out.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+	}
+
+	uint8_t paeth_predictor(const int a, const int b, const int c) noexcept
+	{
+		const int p = a+b-c;
+		const int pa = std::abs(p-a);
+		const int pb = std::abs(p-b);
+		const int pc = std::abs(p-c);
+
+		if(pa<=pb && pa<=pc)
+			return a;
+
+		return pb<=pc ? b : c;
+	}
+
+	//writes the filter type byte and the filtered row into out, prev is nullptr for the first row
+	void filter_row(const filter_type filter, const uint8_t* row, const uint8_t* prev,
+		const size_t row_size, const size_t bpp, uint8_t* out) noexcept
+	{
+		if(filter==filter_type::adaptive)
+		{
+			//picks the filter with the smallest sum of absolute (signed) values, the usual heuristic
+			std::vector<uint8_t> candidate(row_size+1);
+
+			unsigned long best_sum = ULONG_MAX;
+			for(const filter_type f : {filter_type::none, filter_type::sub, filter_type::up, filter_type::average, filter_type::paeth})
+			{
+				filter_row(f, row, prev, row_size, bpp, candidate.data());
+
+				unsigned long sum = 0;
+				for(size_t i = 1; i <= row_size; ++i)
+					sum += std::abs(static_cast<int8_t>(candidate[i]));
+
+				if(sum < best_sum)
+				{
+					best_sum = sum;
+					std::copy(candidate.begin(), candidate.end(), out);
+				}
+			}
+
+			return;
+		}
+
+		out[0] = static_cast<uint8_t>(filter)-static_cast<uint8_t>(filter_type::none);
+		for(size_t i = 0; i < row_size; ++i)
+		{
+			const int a = i>=bpp ? row[i-bpp] : 0;
+			const int b = prev ? prev[i] : 0;
+			const int c = (prev && i>=bpp) ? prev[i-bpp] : 0;
+
+			int predicted;
+			switch(filter)
+			{
+				case filter_type::sub:
+					predicted = a;
+					break;
+
+				case filter_type::up:
+					predicted = b;
+					break;
+
+				case filter_type::average:
+					predicted = (a+b)/2;
+					break;
+
+				case filter_type::paeth:
+					predicted = paeth_predictor(a, b, c);
+					break;
+
+				default:
+					predicted = 0;
+					break;
+			}
+
+			out[i+1] = row[i]-predicted;
+		}
+	}
+
+	struct deflated_band
+	{
+		std::vector<uint8_t> data;
+		uLong adler = 1;
+	};
+
+	//raw deflate of one band, everything but the last one ends on a byte boundary (sync flush)
+	//so the bands can be concatenated, the end of the previous band is used as the dictionary
+	deflated_band deflate_band(const uint8_t* begin, const size_t length, const size_t dictionary_length,
+		const int level, const bool last)
+	{
+		z_stream stream{};
+		if(deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+			throw std::runtime_error("png compression failed");
+
+		if(dictionary_length!=0)
+			deflateSetDictionary(&stream, begin-dictionary_length, dictionary_length);
+
+		deflated_band band;
+		band.data.resize(deflateBound(&stream, length)+16);
+		band.adler = adler32(1, begin, length);
+
+		stream.next_in = const_cast<uint8_t*>(begin);
+		stream.avail_in = length;
+		stream.next_out = band.data.data();
+		stream.avail_out = band.data.size();
+
+		const int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+		const bool finished = last ? result==Z_STREAM_END : (result==Z_OK && stream.avail_in==0);
+
+		band.data.resize(stream.total_out);
+		deflateEnd(&stream);
+
+		if(!finished)
+			throw std::runtime_error("png compression failed");
+
+		return band;
+	}
+
+	//reverses filter_row in place, prev is nullptr for the first row
+	void unfilter_row(const uint8_t filter, uint8_t* row, const uint8_t* prev,
+		const size_t row_size, const size_t bpp)
+	{
+		for(size_t i = 0; i < row_size; ++i)
+		{
+			const int a = i>=bpp ? row[i-bpp] : 0;
+			const int b = prev ? prev[i] : 0;
+			const int c = (prev && i>=bpp) ? prev[i-bpp] : 0;
+
+			switch(filter)
+			{
+				case 0:
+					break;
+
+				case 1:
+					row[i] += a;
+					break;
+
+				case 2:
+					row[i] += b;
+					break;
+
+				case 3:
+					row[i] += (a+b)/2;
+					break;
+
+				case 4:
+					row[i] += paeth_predictor(a, b, c);
+					break;
+
+				default:
+					throw std::runtime_error(std::string("unknown png filter: ") + std::to_string(filter));
+			}
+		}
+	}
+
+	uint32_t read_u32(const uint8_t* data) noexcept
+	{
+		return (static_cast<uint32_t>(data[0])<<24) | (data[1]<<16) | (data[2]<<8) | data[3];
+	}
+
+	unsigned channels(const color_type type)
+	{
+		switch(type)
+		{
+			case color_type::grayscale:
+			case color_type::indexed:
+				return 1;
+
+			case color_type::grayscale_alpha:
+				return 2;
+
+			case color_type::rgb:
+				return 3;
+
+			case color_type::rgba:
+				return 4;
+
+			default:
+				throw std::runtime_error("unknown png color type");
+		}
+	}
+}
+
+size_t image_info::row_size() const noexcept
+{
+	return (static_cast<size_t>(width)*channels(type)*bit_depth+7)/8;
+}
+
+uint8_t png::indexed_depth(const size_t colors_amount)
+{
+	if(colors_amount<=2)
+		return 1;
+
+	if(colors_amount<=4)
+		return 2;
+
+	if(colors_amount<=16)
+		return 4;
+
+	if(colors_amount<=256)
+		return 8;
+
+	throw std::runtime_error(std::string("cant index more than 256 colors in a png: ") + std::to_string(colors_amount));
+}
+
+std::vector<uint8_t> png::pack_indices(const uint8_t* indices,
+	const unsigned width, const unsigned height, const uint8_t bit_depth)
+{
+	const size_t row_size = (static_cast<size_t>(width)*bit_depth+7)/8;
+	const unsigned per_byte = 8/bit_depth;
+
+	std::vector<uint8_t> packed(row_size*height, 0);
+	for(unsigned y = 0; y < height; ++y)
+	{
+		uint8_t* row = packed.data()+y*row_size;
+		for(unsigned x = 0; x < width; ++x)
+		{
+			//leftmost pixel goes into the highest bits
+			const unsigned shift = (per_byte-1-x%per_byte)*bit_depth;
+			row[x/per_byte] |= indices[y*width+x]<<shift;
+		}
+	}
+
+	return packed;
+}
+
+png::filter_type png::parse_filter(const std::string str)
+{
+	if(str=="automatic")
+	{
+		return filter_type::automatic;
+	} else if(str=="none")
+	{
+		return filter_type::none;
+	} else if(str=="sub")
+	{
+		return filter_type::sub;
+	} else if(str=="up")
+	{
+		return filter_type::up;
+	} else if(str=="average")
+	{
+		return filter_type::average;
+	} else if(str=="paeth")
+	{
+		return filter_type::paeth;
+	} else if(str=="adaptive")
+	{
+		return filter_type::adaptive;
+	} else
+	{
+		throw std::runtime_error(std::string("unknown png filter: ") + str);
+	}
+}
+
+void png::write(std::ostream& out, const image_info& info, const uint8_t* rows, const encode_options options)
+{
+	const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+	out.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+	std::vector<uint8_t> header;
+	push_u32(header, info.width);
+	push_u32(header, info.height);
+	header.push_back(info.bit_depth);
+	header.push_back(static_cast<uint8_t>(info.type));
+	//compression, filter method, no interlacing
+	header.push_back(0);
+	header.push_back(0);
+	header.push_back(0);
+	write_chunk(out, "IHDR", header);
+
+	if(info.type==color_type::indexed)
+	{
+		write_chunk(out, "PLTE", info.palette);
+
+		if(!info.palette_alpha.empty())
+			write_chunk(out, "tRNS", info.palette_alpha);
+	}
+
+	const size_t row_size = info.row_size();
+	const size_t filtered_row_size = row_size+1;
+
+	//filters work on whole bytes, so sub byte images use a distance of 1
+	const size_t bpp = std::max<size_t>(1, channels(info.type)*info.bit_depth/8);
+
+	filter_type filter = options.filter;
+	if(filter==filter_type::automatic)
+		filter = (info.type==color_type::indexed || info.bit_depth<8) ? filter_type::none : filter_type::adaptive;
+
+	const unsigned threads_amount = options.threads!=0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+
+	//bands smaller than this arent worth a thread and cost compression ratio
+	const size_t min_band_size = 1<<18;
+	const size_t min_band_rows = std::max<size_t>(1, min_band_size/filtered_row_size);
+	const size_t band_rows = std::max<size_t>(min_band_rows, (info.height+threads_amount-1)/std::max(1u, threads_amount));
+	const size_t bands_amount = std::max<size_t>(1, (info.height+band_rows-1)/band_rows);
+
+	const auto for_each_band = [&](auto func)
+	{
+		std::vector<std::thread> workers;
+		workers.reserve(bands_amount);
+
+		for(size_t band = 0; band < bands_amount; ++band)
+			workers.emplace_back(func, band);
+
+		for(auto& w : workers)
+			w.join();
+	};
+
+	std::vector<uint8_t> filtered(filtered_row_size*info.height);
+	for_each_band([&](const size_t band)
+	{
+		const trace::scope trace_scope("png filter");
+
+		const size_t end = std::min<size_t>(info.height, (band+1)*band_rows);
+		for(size_t y = band*band_rows; y < end; ++y)
+		{
+			filter_row(filter, rows+y*row_size, y==0 ? nullptr : rows+(y-1)*row_size,
+				row_size, bpp, filtered.data()+y*filtered_row_size);
+		}
+	});
+
+	std::vector<deflated_band> deflated(bands_amount);
+	std::vector<std::exception_ptr> errors(bands_amount);
+	for_each_band([&](const size_t band)
+	{
+		const trace::scope trace_scope("png deflate");
+
+		try
+		{
+			const size_t begin = band*band_rows*filtered_row_size;
+			const size_t end = std::min<size_t>(info.height, (band+1)*band_rows)*filtered_row_size;
+
+			deflated[band] = deflate_band(filtered.data()+begin, end-begin, std::min<size_t>(begin, 1<<15),
+				options.level, band==bands_amount-1);
+		} catch(...)
+		{
+			errors[band] = std::current_exception();
+		}
+	});
+
+	for(const auto& e : errors)
+	{
+		if(e)
+			std::rethrow_exception(e);
+	}
+
+	std::vector<uint8_t> compressed;
+
+	//zlib header for a 32k window with the level hint, the check bits make it divisible by 31
+	const int level = options.level==Z_DEFAULT_COMPRESSION ? 6 : options.level;
+	const uint8_t level_hint = level<2 ? 0 : (level<6 ? 1 : (level==6 ? 2 : 3));
+
+	const uint8_t cmf = 0x78;
+	uint8_t flg = level_hint<<6;
+	flg += 31-((cmf*256+flg)%31);
+
+	compressed.push_back(cmf);
+	compressed.push_back(flg);
+
+	uLong adler = 1;
+	for(size_t band = 0; band < bands_amount; ++band)
+	{
+		compressed.insert(compressed.end(), deflated[band].data.begin(), deflated[band].data.end());
+
+		const size_t begin = band*band_rows*filtered_row_size;
+		const size_t end = std::min<size_t>(info.height, (band+1)*band_rows)*filtered_row_size;
+		adler = band==0 ? deflated[band].adler : adler32_combine(adler, deflated[band].adler, end-begin);
+	}
+
+	push_u32(compressed, adler);
+
+	write_chunk(out, "IDAT", compressed);
+
+	write_chunk(out, "IEND", {});
+}
+
+decoded_image png::read(std::istream& in)
+{
+	const trace::scope trace_scope("png decode");
+
+	const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+	uint8_t read_signature[8];
+	if(!in.read(reinterpret_cast<char*>(read_signature), 8) || !std::equal(signature, signature+8, read_signature))
+		throw std::runtime_error("not a png");
+
+	image_info info;
+	bool interlaced = false;
+	std::vector<uint8_t> compressed;
+
+	while(true)
+	{
+		uint8_t chunk_header[8];
+		if(!in.read(reinterpret_cast<char*>(chunk_header), 8))
+			throw std::runtime_error("png ended early");
+
+		const uint32_t length = read_u32(chunk_header);
+		const std::string name(reinterpret_cast<const char*>(chunk_header+4), 4);
+
+		//name is included in the crc
+		std::vector<uint8_t> data(length+4);
+		std::copy(chunk_header+4, chunk_header+8, data.begin());
+
+		uint8_t crc[4];
+		if(!in.read(reinterpret_cast<char*>(data.data()+4), length) || !in.read(reinterpret_cast<char*>(crc), 4))
+			throw std::runtime_error("png ended early");
+
+		if(crc32(crc32(0, nullptr, 0), data.data(), data.size())!=read_u32(crc))
+			throw std::runtime_error(std::string("broken png chunk: ") + name);
+
+		const uint8_t* body = data.data()+4;
+		if(name=="IHDR")
+		{
+			if(length < 13)
+				throw std::runtime_error("broken png header");
+
+			info.width = read_u32(body);
+			info.height = read_u32(body+4);
+			info.bit_depth = body[8];
+			info.type = static_cast<color_type>(body[9]);
+			interlaced = body[12]!=0;
+		} else if(name=="PLTE")
+		{
+			info.palette.assign(body, body+length);
+		} else if(name=="tRNS")
+		{
+			info.palette_alpha.assign(body, body+length);
+		} else if(name=="IDAT")
+		{
+			compressed.insert(compressed.end(), body, body+length);
+		} else if(name=="IEND")
+		{
+			break;
+		}
+	}
+
+	if(interlaced)
+		throw std::runtime_error("interlaced pngs arent supported");
+
+	const size_t row_size = info.row_size();
+	const size_t filter_bpp = std::max<size_t>(1, channels(info.type)*info.bit_depth/8);
+
+	std::vector<uint8_t> filtered(info.height*(row_size+1));
+	uLongf filtered_size = filtered.size();
+	if(uncompress(filtered.data(), &filtered_size, compressed.data(), compressed.size())!=Z_OK || filtered_size!=filtered.size())
+		throw std::runtime_error("broken png data");
+
+	const bool indexed = info.type==color_type::indexed;
+
+	decoded_image decoded;
+	decoded.width = info.width;
+	decoded.height = info.height;
+	decoded.channels = indexed ? (info.palette_alpha.empty() ? 3 : 4) : channels(info.type);
+	decoded.data.resize(static_cast<size_t>(info.width)*info.height*decoded.channels);
+
+	const unsigned samples = info.width*channels(info.type);
+	const unsigned max_sample = (1<<std::min<int>(info.bit_depth, 8))-1;
+
+	for(unsigned y = 0; y < info.height; ++y)
+	{
+		uint8_t* row = filtered.data()+y*(row_size+1);
+		const uint8_t* prev = y==0 ? nullptr : row-row_size;
+
+		unfilter_row(row[0], row+1, prev, row_size, filter_bpp);
+
+		uint8_t* out = decoded.data.data()+static_cast<size_t>(y)*info.width*decoded.channels;
+		for(unsigned i = 0; i < samples; ++i)
+		{
+			unsigned sample;
+			if(info.bit_depth==16)
+			{
+				sample = row[1+i*2];
+			} else if(info.bit_depth==8)
+			{
+				sample = row[1+i];
+			} else
+			{
+				const unsigned per_byte = 8/info.bit_depth;
+				const unsigned shift = (per_byte-1-i%per_byte)*info.bit_depth;
+
+				sample = (row[1+i/per_byte]>>shift)&max_sample;
+			}
+
+			if(indexed)
+			{
+				if(sample*3+2 >= info.palette.size())
+					throw std::runtime_error("png index outside of its palette");
+
+				for(int c = 0; c < 3; ++c)
+					*(out++) = info.palette[sample*3+c];
+
+				if(decoded.channels==4)
+					*(out++) = sample < info.palette_alpha.size() ? info.palette_alpha[sample] : 255;
+			} else
+			{
+				//grayscale under 8 bits gets stretched to the full range
+				*(out++) = info.bit_depth<8 ? sample*255/max_sample : sample;
+			}
+		}
+	}
+
+	return decoded;
+}
+
+void png::save(const std::filesystem::path path, const image_info& info, const uint8_t* rows, const encode_options options)
+{
+	std::ofstream out(path, std::ios::binary);
+	if(!out)
+		throw std::runtime_error(std::string("cant open file for writing: ") + path.string());
+
+	write(out, info, rows, options);
+}
@@ -0,0 +1,75 @@
+#ifndef YAN_PNG_H
+#define YAN_PNG_H
+
+#include <vector>
+#include <filesystem>
+#include <ostream>
+#include <istream>
+#include <cstdint>
+#include <string>
+
+
+namespace png
+{
+	enum class color_type : uint8_t {grayscale = 0, rgb = 2, indexed = 3, grayscale_alpha = 4, rgba = 6};
+
+	//automatic picks none for palettized and sub byte images and adaptive for the rest
+	enum class filter_type{automatic, none, sub, up, average, paeth, adaptive};
+
+	struct encode_options
+	{
+		//zlib level, -1 is zlibs default
+		int level = -1;
+		filter_type filter = filter_type::automatic;
+
+		//0 uses every hardware thread
+		unsigned threads = 0;
+	};
+
+	filter_type parse_filter(const std::string str);
+
+	struct image_info
+	{
+		unsigned width = 0;
+		unsigned height = 0;
+		uint8_t bit_depth = 8;
+		color_type type = color_type::rgb;
+
+		//packed RGB triplets, only used by indexed images
+		std::vector<uint8_t> palette = {};
+
+		//alpha of the first few palette entries (tRNS chunk), the rest are opaque
+		std::vector<uint8_t> palette_alpha = {};
+
+		size_t row_size() const noexcept;
+	};
+
+	//smallest bit depth that can index a palette with colors_amount colors
+	uint8_t indexed_depth(const size_t colors_amount);
+
+	//packs one index per byte into rows of bit_depth bits per pixel (each row starts on a new byte)
+	std::vector<uint8_t> pack_indices(const uint8_t* indices,
+		const unsigned width, const unsigned height, const uint8_t bit_depth);
+
+	//decoded pixels, 8 bits per channel with palettes expanded
+	struct decoded_image
+	{
+		unsigned width = 0;
+		unsigned height = 0;
+
+		//1 grayscale, 2 grayscale with alpha, 3 rgb, 4 rgba
+		unsigned channels = 0;
+
+		std::vector<uint8_t> data = {};
+	};
+
+	//reads one (non interlaced) png and leaves in right after it, so pngs can follow each other in a stream
+	decoded_image read(std::istream& in);
+
+	//rows are height rows of info.row_size() bytes each
+	//bands of rows get filtered and deflated on separate threads and stitched into one zlib stream
+	void write(std::ostream& out, const image_info& info, const uint8_t* rows, const encode_options options = {});
+	void save(const std::filesystem::path path, const image_info& info, const uint8_t* rows, const encode_options options = {});
+};
+
+#endif
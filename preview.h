@@ -0,0 +1,186 @@
+#ifndef YAN_PREVIEW_H
+#define YAN_PREVIEW_H
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <cmath>
+
+#include "dither.h"
+#include "trace.h"
+
+
+namespace dither
+{
+	//previews of one image with palettes that keep changing (like while one is being edited)
+	//
+	//every render gives a quick ordered dither of a downscaled copy sized to fit in the latency first
+	//and then the full result, starting a newer render (or cancelling) stops the older one at its next row
+	//the image gets resized once and the downscaled copy is kept around, so only the dithering is redone,
+	//ordered stages also keep their converted pixels as long as the palette size stays the same
+	template<class T_color>
+	class preview_ditherer
+	{
+	public:
+		typedef palette<T_color> palette_type;
+
+		//image gets resized to width and height (0 keeps that side), type is the dithering of the full result
+		preview_ditherer(yconv::image image, const unsigned width, const unsigned height,
+			const ditherer_base::dither_type type,
+			const std::chrono::milliseconds latency = std::chrono::milliseconds(50), const float error_mult = 1)
+		: _type(type), _latency(latency), _error_mult(error_mult)
+		{
+			ditherer_base resizer(std::move(image));
+			if(width!=0 || height!=0)
+				resizer.resize(width==0 ? resizer.width() : width, height==0 ? resizer.height() : height);
+
+			_full = std::make_shared<stage>(resizer.image());
+		}
+
+		//calls on_result(const indexed_image&, bool final) with the quick result and then the final one,
+		//theres only the final one if the whole image fits in the latency
+		//returns false if it got stopped, renders can be started from several threads at once
+		template<typename F>
+		bool render(const std::shared_ptr<const palette_type> colors_palette, F on_result)
+		{
+			const uint64_t generation = ++_generation;
+			const auto stop = [this, generation](){return _generation.load(std::memory_order_relaxed)!=generation;};
+
+			const trace::scope trace_scope("preview");
+
+			const float latency_seconds = std::chrono::duration<float>(_latency).count();
+			const size_t quick_pixels = std::max(1.0f, _pixels_per_second.load()*latency_seconds);
+
+			if(quick_pixels < static_cast<size_t>(_full->image.width)*_full->image.height)
+			{
+				const std::shared_ptr<stage> quick = quick_stage(quick_pixels);
+				if(!render_stage(*quick, ditherer_base::dither_type::ordered, colors_palette, stop, on_result, false))
+					return false;
+			}
+
+			return render_stage(*_full, _type, colors_palette, stop, on_result, true);
+		}
+
+		//stops the render in progress if theres one
+		void cancel() noexcept
+		{
+			++_generation;
+		}
+
+		const yconv::image& image() const noexcept
+		{
+			return _full->image;
+		}
+
+	private:
+		//an image being rendered and its pixels converted for ordered dithering with palettes of colors_amount colors
+		struct stage
+		{
+			stage(yconv::image image)
+			: image(std::move(image))
+			{
+			}
+
+			yconv::image image;
+
+			std::mutex converted_mutex;
+			size_t colors_amount = 0;
+			std::shared_ptr<const std::vector<T_color>> converted;
+		};
+
+		std::shared_ptr<const std::vector<T_color>> converted_colors(stage& rendered,
+			const ditherer<T_color>& stage_ditherer, const size_t colors_amount)
+		{
+			std::lock_guard<std::mutex> lock(rendered.converted_mutex);
+
+			if(!rendered.converted || rendered.colors_amount!=colors_amount)
+			{
+				rendered.converted = std::make_shared<const std::vector<T_color>>(stage_ditherer.ordered_colors(_error_mult));
+				rendered.colors_amount = colors_amount;
+			}
+
+			return rendered.converted;
+		}
+
+		template<typename S, typename F>
+		bool render_stage(stage& rendered, const ditherer_base::dither_type type,
+			const std::shared_ptr<const palette_type> colors_palette, S stop, F on_result, const bool final)
+		{
+			const auto start = std::chrono::steady_clock::now();
+
+			const yconv::image& stage_image = rendered.image;
+
+			const ditherer<T_color> stage_ditherer(stage_image, colors_palette);
+			indexed_image out(stage_image.width, stage_image.height, colors_palette, stage_image.bpp==4);
+
+			const auto set_pixel = [&](const int x, const int y, const size_t index)
+			{
+				out.set_index(x, y, index);
+
+				if(stage_image.bpp==4)
+					out.set_alpha(x, y, stage_image.pixel_color(x, y, 3));
+			};
+
+			bool finished;
+			if(type==ditherer_base::dither_type::ordered)
+			{
+				const auto converted = converted_colors(rendered, stage_ditherer, colors_palette->colors().size());
+				finished = stage_ditherer.dither_ordered_colors(*converted, set_pixel, stop);
+			} else
+			{
+				finished = stage_ditherer.dither_until(type, set_pixel, stop, _error_mult);
+			}
+
+			if(!finished)
+				return false;
+
+			//the next quick result gets sized by how fast this one went
+			const float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now()-start).count();
+			if(!final && seconds > 0)
+				_pixels_per_second.store(static_cast<float>(stage_image.width)*stage_image.height/seconds);
+
+			on_result(out, final);
+
+			return true;
+		}
+
+		std::shared_ptr<stage> quick_stage(const size_t pixels)
+		{
+			std::lock_guard<std::mutex> lock(_quick_mutex);
+
+			//only redone when the speed changes a lot, otherwise palette changes keep reusing it
+			const size_t current_pixels = _quick ? static_cast<size_t>(_quick->image.width)*_quick->image.height : 0;
+			if(!_quick || current_pixels > pixels*2 || current_pixels*2 < pixels)
+			{
+				const trace::scope trace_scope("preview resize");
+
+				const yconv::image& full_image = _full->image;
+				const float scale = std::sqrt(static_cast<float>(pixels)/(full_image.width*full_image.height));
+
+				ditherer_base resizer(full_image);
+				resizer.resize(std::max(1.0f, full_image.width*scale), std::max(1.0f, full_image.height*scale));
+
+				_quick = std::make_shared<stage>(resizer.image());
+			}
+
+			return _quick;
+		}
+
+		ditherer_base::dither_type _type;
+		std::chrono::milliseconds _latency;
+		float _error_mult;
+
+		std::shared_ptr<stage> _full;
+
+		std::mutex _quick_mutex;
+		std::shared_ptr<stage> _quick;
+
+		std::atomic<uint64_t> _generation = 0;
+
+		//a guess until the first render measures it
+		std::atomic<float> _pixels_per_second = 1000000;
+	};
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include <fstream>
+#include <algorithm>
+
+#include "scheduler.h"
+#include "stream.h"
+
+
+using namespace dither;
+
+namespace
+{
+	uint32_t read_big_endian(const uint8_t* data, const int bytes) noexcept
+	{
+		uint32_t value = 0;
+		for(int i = 0; i < bytes; ++i)
+			value = (value<<8) | data[i];
+
+		return value;
+	}
+
+	bool read_png_header(std::ifstream& file, image_header& header)
+	{
+		//signature, then the IHDR chunk always comes first
+		uint8_t data[8+8+13];
+		if(!file.read(reinterpret_cast<char*>(data), sizeof(data)))
+			return false;
+
+		const uint8_t* ihdr = data+16;
+
+		header.width = read_big_endian(ihdr, 4);
+		header.height = read_big_endian(ihdr+4, 4);
+
+		switch(ihdr[9])
+		{
+			case 0: header.bpp = 1; break;
+			case 2: header.bpp = 3; break;
+			case 3: header.bpp = 3; break;
+			case 4: header.bpp = 2; break;
+			case 6: header.bpp = 4; break;
+			default: return false;
+		}
+
+		return true;
+	}
+
+	bool read_jpeg_header(std::ifstream& file, image_header& header)
+	{
+		file.seekg(2);
+
+		//skips segments until a start of frame one
+		while(file)
+		{
+			uint8_t marker[4];
+			if(!file.read(reinterpret_cast<char*>(marker), 2) || marker[0]!=0xff)
+				return false;
+
+			//fill bytes
+			if(marker[1]==0xff)
+			{
+				file.seekg(-1, std::ios::cur);
+				continue;
+			}
+
+			if(!file.read(reinterpret_cast<char*>(marker+2), 2))
+				return false;
+
+			const uint32_t length = read_big_endian(marker+2, 2);
+			const bool start_of_frame = marker[1]>=0xc0 && marker[1]<=0xcf
+				&& marker[1]!=0xc4 && marker[1]!=0xc8 && marker[1]!=0xcc;
+
+			if(start_of_frame)
+			{
+				uint8_t frame[6];
+				if(!file.read(reinterpret_cast<char*>(frame), sizeof(frame)))
+					return false;
+
+				header.height = read_big_endian(frame+1, 2);
+				header.width = read_big_endian(frame+3, 2);
+				header.bpp = frame[5];
+
+				return true;
+			}
+
+			file.seekg(length-2, std::ios::cur);
+		}
+
+		return false;
+	}
+}
+
+bool dither::read_header(const std::filesystem::path path, image_header& header)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	uint8_t magic[8];
+	if(!file.read(reinterpret_cast<char*>(magic), sizeof(magic)))
+		return false;
+
+	file.seekg(0);
+
+	try
+	{
+		const uint8_t png_magic[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+		if(std::equal(magic, magic+8, png_magic))
+			return read_png_header(file, header);
+
+		if(magic[0]==0xff && magic[1]==0xd8)
+			return read_jpeg_header(file, header);
+
+		if(magic[0]=='P' && (magic[1]=='5' || magic[1]=='6' || magic[1]=='7'))
+		{
+			const stream::netpbm_header netpbm = stream::read_netpbm_header(file);
+			header = image_header{netpbm.width, netpbm.height, netpbm.channels};
+
+			return true;
+		}
+	} catch(const std::exception&)
+	{
+		//broken netpbm header
+	}
+
+	return false;
+}
+
+memory_budget::reservation::reservation(memory_budget& budget, const size_t bytes)
+: _budget(budget), _bytes(bytes)
+{
+	_budget.acquire(_bytes);
+}
+
+memory_budget::reservation::reservation(memory_budget& budget, const size_t bytes, std::adopt_lock_t)
+: _budget(budget), _bytes(bytes)
+{
+}
+
+memory_budget::reservation::~reservation()
+{
+	_budget.release(_bytes);
+}
+
+memory_budget::memory_budget(const size_t limit)
+: _limit(limit)
+{
+}
+
+void memory_budget::acquire(const size_t bytes)
+{
+	std::unique_lock lock(_mutex);
+	_released.wait(lock, [this, bytes]{return available(bytes);});
+
+	_used += bytes;
+}
+
+bool memory_budget::try_acquire(const size_t bytes)
+{
+	std::lock_guard lock(_mutex);
+	if(!available(bytes))
+		return false;
+
+	_used += bytes;
+
+	return true;
+}
+
+void memory_budget::release(const size_t bytes)
+{
+	{
+		std::lock_guard lock(_mutex);
+		_used -= bytes;
+	}
+
+	_released.notify_all();
+}
+
+bool memory_budget::fits(const size_t bytes) const noexcept
+{
+	return _limit==0 || bytes<=_limit;
+}
+
+size_t memory_budget::limit() const noexcept
+{
+	return _limit;
+}
+
+bool memory_budget::available(const size_t bytes) const noexcept
+{
+	//too big to ever fit, so it gets the whole budget to itself
+	if(!fits(bytes))
+		return _used==0;
+
+	return _limit==0 || _used+bytes<=_limit;
+}
@@ -0,0 +1,74 @@
+#ifndef YAN_SCHEDULER_H
+#define YAN_SCHEDULER_H
+
+#include <filesystem>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+
+namespace dither
+{
+	struct image_header
+	{
+		unsigned width = 0;
+		unsigned height = 0;
+
+		//channels the decoded image has
+		unsigned bpp = 0;
+	};
+
+	//reads just enough of a png, jpeg or netpbm (P5, P6, P7) file to know its size,
+	//returns false if its something else or broken
+	bool read_header(const std::filesystem::path path, image_header& header);
+
+	//bytes of memory shared between concurrent jobs, each job waits until its estimated peak fits
+	class memory_budget
+	{
+	public:
+		//holds bytes of the budget until its destroyed
+		class reservation
+		{
+		public:
+			reservation(memory_budget& budget, const size_t bytes);
+
+			//takes over bytes that were already acquired
+			reservation(memory_budget& budget, const size_t bytes, std::adopt_lock_t);
+			~reservation();
+
+			reservation(const reservation&) = delete;
+			reservation& operator=(const reservation&) = delete;
+
+		private:
+			memory_budget& _budget;
+			size_t _bytes;
+		};
+
+		//0 is no limit
+		memory_budget(const size_t limit = 0);
+
+		//waits until bytes fit, something bigger than the whole limit waits until nothing else is running
+		void acquire(const size_t bytes);
+
+		//same as acquire but gives up instead of waiting
+		bool try_acquire(const size_t bytes);
+
+		void release(const size_t bytes);
+
+		//true if bytes fit in the limit without having to run alone
+		bool fits(const size_t bytes) const noexcept;
+
+		size_t limit() const noexcept;
+
+	private:
+		bool available(const size_t bytes) const noexcept;
+
+		std::mutex _mutex;
+		std::condition_variable _released;
+
+		size_t _limit;
+		size_t _used = 0;
+	};
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef YAN_SEQUENCE_H
+#define YAN_SEQUENCE_H
+
+#include <vector>
+#include <memory>
+#include <cstring>
+
+#include "dither.h"
+
+
+namespace dither
+{
+	//dithers the frames of a sequence redoing only what changed since the previous frame,
+	//changed tiles with ordered dithering and everything from the first changed row on with error diffusion
+	template<class T_color>
+	class sequence_ditherer
+	{
+	public:
+		sequence_ditherer(const ditherer_base::dither_type type, const int tile_size = 32, const float error_mult = 1)
+		: _type(type), _tile_size(tile_size), _error_mult(error_mult)
+		{
+		}
+
+		//frame_ditherer has to be already resized, the palette should be shared between the frames
+		const indexed_image& next(const ditherer<T_color>& frame_ditherer)
+		{
+			const yconv::image& frame = frame_ditherer.image();
+
+			const auto writer = [this, &frame](const int x, const int y, const size_t index)
+			{
+				_output.set_index(x, y, index);
+
+				if(frame.bpp==4)
+					_output.set_alpha(x, y, frame.pixel_color(x, y, 3));
+			};
+
+			const bool same_layout = _frames!=0 && frame.width==_previous.width
+				&& frame.height==_previous.height && frame.bpp==_previous.bpp;
+
+			_changed_pixels = 0;
+			if(!same_layout)
+			{
+				_output = indexed_image(frame.width, frame.height, frame_ditherer.colors_palette(), frame.bpp==4);
+
+				if(_type==ditherer_base::dither_type::ordered)
+				{
+					frame_ditherer.dither_region(0, 0, frame.width, frame.height, writer, _error_mult);
+				} else
+				{
+					_errors.assign(frame_ditherer.error_buffer_size(), color<float>{});
+					frame_ditherer.dither_resume(_type, _errors, 0, writer, _error_mult);
+				}
+
+				_changed_pixels = static_cast<size_t>(frame.width)*frame.height;
+			} else if(_type==ditherer_base::dither_type::ordered)
+			{
+				for(int tile_y = 0; tile_y < frame.height; tile_y += _tile_size)
+				{
+					for(int tile_x = 0; tile_x < frame.width; tile_x += _tile_size)
+					{
+						const int x_end = std::min<int>(frame.width, tile_x+_tile_size);
+						const int y_end = std::min<int>(frame.height, tile_y+_tile_size);
+
+						if(!changed(frame, tile_x, tile_y, x_end, y_end))
+							continue;
+
+						frame_ditherer.dither_region(tile_x, tile_y, x_end, y_end, writer, _error_mult);
+						_changed_pixels += static_cast<size_t>(x_end-tile_x)*(y_end-tile_y);
+					}
+				}
+			} else
+			{
+				int first_changed = 0;
+				while(first_changed < frame.height && !changed(frame, 0, first_changed, frame.width, first_changed+1))
+					++first_changed;
+
+				if(first_changed < frame.height)
+				{
+					frame_ditherer.dither_resume(_type, _errors, first_changed, writer, _error_mult);
+					_changed_pixels = static_cast<size_t>(frame.width)*(frame.height-first_changed);
+				}
+			}
+
+			_previous = frame;
+			++_frames;
+
+			return _output;
+		}
+
+		//pixels that got dithered again for the last frame
+		size_t changed_pixels() const noexcept
+		{
+			return _changed_pixels;
+		}
+
+	private:
+		bool changed(const yconv::image& frame, const int x_begin, const int y_begin, const int x_end, const int y_end) const noexcept
+		{
+			const size_t row_size = static_cast<size_t>(frame.width)*frame.bpp;
+			const size_t span = static_cast<size_t>(x_end-x_begin)*frame.bpp;
+
+			for(int y = y_begin; y < y_end; ++y)
+			{
+				const size_t offset = y*row_size+x_begin*frame.bpp;
+				if(std::memcmp(frame.data.data()+offset, _previous.data.data()+offset, span)!=0)
+					return true;
+			}
+
+			return false;
+		}
+
+		ditherer_base::dither_type _type;
+		int _tile_size;
+		float _error_mult;
+
+		size_t _frames = 0;
+		size_t _changed_pixels = 0;
+
+		yconv::image _previous;
+		indexed_image _output;
+		std::vector<color<float>> _errors;
+	};
+};
+
+#endif
@@ -0,0 +1,276 @@
+#include <iostream>
+#include <sstream>
+#include <atomic>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#include "job.h"
+#include "server.h"
+
+
+using namespace dither;
+
+namespace
+{
+	std::atomic<bool> stop_requested = false;
+
+	//clients that dont send anything for this long get dropped so they dont keep a worker forever
+	const timeval client_timeout{60, 0};
+
+	void stop_handler(int)
+	{
+		stop_requested = true;
+	}
+
+	//splits a tab separated list of key=value fields
+	std::map<std::string, std::string> parse_fields(const std::string line)
+	{
+		std::map<std::string, std::string> fields;
+
+		std::stringstream line_stream(line);
+		std::string field;
+		while(std::getline(line_stream, field, '\t'))
+		{
+			if(field.empty())
+				continue;
+
+			const size_t separator = field.find('=');
+			if(separator==std::string::npos)
+				throw std::runtime_error(std::string("field without a value: ") + field);
+
+			fields[field.substr(0, separator)] = field.substr(separator+1);
+		}
+
+		return fields;
+	}
+
+	std::string field_or(const std::map<std::string, std::string>& fields, const std::string key, const std::string fallback)
+	{
+		const auto found = fields.find(key);
+		return found==fields.end() ? fallback : found->second;
+	}
+}
+
+palette_cache::palette_cache(const size_t limit)
+: _limit(limit)
+{
+}
+
+server::server(const std::filesystem::path socket_path, const unsigned workers_amount, const size_t memory_limit)
+: _socket_path(socket_path), _palettes(64), _budget(memory_limit), _queue_limit(workers_amount*4)
+{
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+
+	const std::string path_string = _socket_path.string();
+	if(path_string.size() >= sizeof(address.sun_path))
+		throw std::runtime_error(std::string("socket path too long: ") + path_string);
+
+	std::strncpy(address.sun_path, path_string.c_str(), sizeof(address.sun_path)-1);
+
+	if(std::filesystem::is_socket(_socket_path))
+		std::filesystem::remove(_socket_path);
+
+	_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(_listener==-1)
+		throw std::runtime_error(std::string("cant create socket: ") + std::strerror(errno));
+
+	if(bind(_listener, reinterpret_cast<sockaddr*>(&address), sizeof(address))==-1
+		|| listen(_listener, SOMAXCONN)==-1)
+	{
+		const std::string error = std::strerror(errno);
+		close(_listener);
+		throw std::runtime_error(std::string("cant listen on ") + path_string + ": " + error);
+	}
+
+	_workers.reserve(workers_amount);
+	for(unsigned i = 0; i < workers_amount; ++i)
+		_workers.emplace_back(&server::worker, this);
+}
+
+server::~server()
+{
+	{
+		std::lock_guard lock(_queue_mutex);
+		_stopping = true;
+
+		for(const int client : _clients)
+			close(client);
+
+		_clients.clear();
+
+		for(const int client : _active_clients)
+			shutdown(client, SHUT_RDWR);
+	}
+	_queue_changed.notify_all();
+
+	for(auto& w : _workers)
+		w.join();
+
+	close(_listener);
+	std::filesystem::remove(_socket_path);
+}
+
+void server::run()
+{
+	struct sigaction action{};
+	action.sa_handler = stop_handler;
+	sigemptyset(&action.sa_mask);
+
+	//no SA_RESTART so accept gets interrupted
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	while(!stop_requested)
+	{
+		const int client = accept(_listener, nullptr, nullptr);
+		if(client==-1)
+		{
+			if(errno==EINTR)
+				continue;
+
+			throw std::runtime_error(std::string("accept failed: ") + std::strerror(errno));
+		}
+
+		//signals cant notify, so stop_requested gets rechecked every now and then
+		std::unique_lock lock(_queue_mutex);
+		while(!_queue_changed.wait_for(lock, std::chrono::milliseconds(100),
+			[this]{return _clients.size() < _queue_limit || stop_requested;}));
+
+		_clients.push_back(client);
+		lock.unlock();
+
+		_queue_changed.notify_all();
+	}
+}
+
+void server::worker()
+{
+	while(true)
+	{
+		std::unique_lock lock(_queue_mutex);
+		_queue_changed.wait(lock, [this]{return !_clients.empty() || _stopping;});
+
+		if(_stopping)
+			return;
+
+		const int client = _clients.front();
+		_clients.pop_front();
+		_active_clients.insert(client);
+		lock.unlock();
+
+		_queue_changed.notify_all();
+
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &client_timeout, sizeof(client_timeout));
+		handle_client(client);
+
+		//closed under the lock so stopping never shuts down a reused descriptor
+		lock.lock();
+		_active_clients.erase(client);
+		close(client);
+	}
+}
+
+void server::handle_client(const int client)
+{
+	std::string pending = "";
+
+	char buffer[4096];
+	while(true)
+	{
+		const ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+		if(received<=0)
+			return;
+
+		pending.append(buffer, received);
+
+		size_t line_end;
+		while((line_end = pending.find('\n'))!=std::string::npos)
+		{
+			const std::string reply = handle_request(pending.substr(0, line_end)) + '\n';
+			pending.erase(0, line_end+1);
+
+			if(send(client, reply.c_str(), reply.size(), MSG_NOSIGNAL)==-1)
+				return;
+		}
+	}
+}
+
+std::string server::handle_request(const std::string line)
+{
+	const trace::scope trace_scope("request");
+
+	try
+	{
+		const auto fields = parse_fields(line);
+
+		const std::string input = field_or(fields, "input", "");
+		const std::string colors = field_or(fields, "colors", "");
+		const std::string colors_path = field_or(fields, "colors_path", "");
+		const std::string distance = field_or(fields, "distance", "LAB");
+
+		if(input=="")
+			throw std::runtime_error("input field is mandatory");
+
+		if(colors=="" && colors_path=="")
+			throw std::runtime_error("colors or colors_path field is mandatory");
+
+		const std::filesystem::path image_path{input};
+
+		dither_args d_args{
+			field_or(fields, "width", ""),
+			field_or(fields, "height", ""),
+			field_or(fields, "total", ""),
+			field_or(fields, "dither", "jarvis"),
+			field_or(fields, "output", image_path.stem().string()),
+			field_or(fields, "format", ""),
+			field_or(fields, "png_level", ""),
+			field_or(fields, "png_filter", ""),
+			field_or(fields, "alpha_threshold", ""),
+			field_or(fields, "bilevel", "")};
+
+		if((d_args.width!="" || d_args.height!="") && d_args.total!="")
+			throw std::runtime_error("cant use width/height fields together with total");
+
+		if(!valid_alpha_threshold(d_args.alpha_threshold))
+			throw std::runtime_error("alpha_threshold has to be between 0 and 255");
+
+		//palette files are keyed by their modification time so edits dont get stale palettes
+		const std::string palette_key = distance + '\n' + (colors_path=="" ?
+			colors
+			: colors_path + '\n' + std::to_string(std::filesystem::last_write_time(colors_path).time_since_epoch().count()));
+
+		const memory_budget::reservation reserved(_budget, plan_memory(image_path, d_args, _budget));
+
+		const yconv::image img = load_image(image_path, d_args.alpha_threshold);
+
+		const bool known_distance = with_distance(distance, [&](auto c)
+		{
+			typedef decltype(c) color_type;
+
+			const auto colors_palette = _palettes.get<color_type>(palette_key, [&]()
+			{
+				return colors_path=="" ?
+					parser::parse_colors(colors)
+					: parser::parse_colors(std::filesystem::path(colors_path));
+			});
+
+			ditherer<color_type> c_dither(img, colors_palette);
+			dither_generic(c_dither, d_args);
+		});
+
+		if(!known_distance)
+			throw std::runtime_error(std::string("unknown distance function: ") + distance);
+
+		return std::string("ok ") + d_args.save_path + format_extension(d_args.format);
+	} catch(const std::exception& e)
+	{
+		return std::string("error ") + e.what();
+	}
+}
@@ -0,0 +1,108 @@
+#ifndef YAN_SERVER_H
+#define YAN_SERVER_H
+
+#include <string>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+
+#include "dither.h"
+#include "scheduler.h"
+
+
+namespace dither
+{
+	class palette_cache
+	{
+	public:
+		palette_cache(const size_t limit);
+
+		//colors_func only gets called (and the colors parsed) if the palette isnt cached already
+		template<class T_color, typename F>
+		std::shared_ptr<const palette<T_color>> get(const std::string key, F colors_func)
+		{
+			{
+				std::lock_guard lock(_mutex);
+
+				const auto found = _lookup.find(key);
+				if(found!=_lookup.end())
+				{
+					_entries.splice(_entries.begin(), _entries, found->second);
+					return std::static_pointer_cast<const palette<T_color>>(found->second->second);
+				}
+			}
+
+			//converting the colors can take a while so its done outside the lock
+			const auto created = std::make_shared<const palette<T_color>>(colors_func());
+
+			std::lock_guard lock(_mutex);
+			if(_lookup.find(key)==_lookup.end())
+			{
+				_entries.emplace_front(key, created);
+				_lookup[key] = _entries.begin();
+
+				if(_entries.size() > _limit)
+				{
+					_lookup.erase(_entries.back().first);
+					_entries.pop_back();
+				}
+			}
+
+			return created;
+		}
+
+	private:
+		typedef std::list<std::pair<std::string, std::shared_ptr<const palette_base>>> entries_type;
+
+		std::mutex _mutex;
+
+		size_t _limit;
+		entries_type _entries;
+		std::map<std::string, entries_type::iterator> _lookup;
+	};
+
+	class server
+	{
+	public:
+		//memory_limit (0 is no limit) is shared by the requests being handled at once
+		server(const std::filesystem::path socket_path, const unsigned workers_amount, const size_t memory_limit = 0);
+		~server();
+
+		server(const server&) = delete;
+		server& operator=(const server&) = delete;
+
+		void run();
+
+	private:
+		void worker();
+
+		void handle_client(const int client);
+		std::string handle_request(const std::string line);
+
+		std::filesystem::path _socket_path;
+		int _listener = -1;
+
+		palette_cache _palettes;
+		memory_budget _budget;
+
+		std::mutex _queue_mutex;
+		std::condition_variable _queue_changed;
+		std::deque<int> _clients;
+
+		//clients being handled, shut down when stopping so workers blocked reading them wake up
+		std::set<int> _active_clients;
+		size_t _queue_limit;
+		bool _stopping = false;
+
+		std::vector<std::thread> _workers;
+	};
+};
+
+#endif
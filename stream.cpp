@@ -0,0 +1,196 @@
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
+
+#include "stream.h"
+#include "png.h"
+#include "trace.h"
+
+
+namespace
+{
+	//next whitespace separated token, skipping comments, the whitespace after it gets consumed too
+	std::string netpbm_token(std::istream& in)
+	{
+		std::string token = "";
+
+		char c;
+		while(in.get(c))
+		{
+			if(c=='#' && token.empty())
+			{
+				std::string comment;
+				std::getline(in, comment);
+			} else if(std::isspace(static_cast<unsigned char>(c)))
+			{
+				if(!token.empty())
+					break;
+			} else
+			{
+				token.push_back(c);
+			}
+		}
+
+		return token;
+	}
+
+	unsigned netpbm_number(std::istream& in)
+	{
+		const std::string token = netpbm_token(in);
+
+		try
+		{
+			return std::stoul(token);
+		} catch(const std::exception&)
+		{
+			throw std::runtime_error(std::string("broken netpbm header value: ") + token);
+		}
+	}
+
+	unsigned tuple_channels(const std::string tuple_type)
+	{
+		if(tuple_type=="GRAYSCALE" || tuple_type=="BLACKANDWHITE")
+			return 1;
+
+		if(tuple_type=="GRAYSCALE_ALPHA")
+			return 2;
+
+		if(tuple_type=="RGB")
+			return 3;
+
+		if(tuple_type=="RGB_ALPHA")
+			return 4;
+
+		return 0;
+	}
+}
+
+stream::netpbm_header stream::read_netpbm_header(std::istream& in)
+{
+	const std::string magic = netpbm_token(in);
+
+	netpbm_header header;
+	if(magic=="P7")
+	{
+		//pam has named fields up to ENDHDR
+		std::string tuple_type = "";
+		while(true)
+		{
+			const std::string field = netpbm_token(in);
+
+			if(field=="ENDHDR")
+				break;
+
+			if(field=="")
+				throw std::runtime_error("pam header ended early");
+
+			if(field=="WIDTH")
+				header.width = netpbm_number(in);
+			else if(field=="HEIGHT")
+				header.height = netpbm_number(in);
+			else if(field=="DEPTH")
+				header.channels = netpbm_number(in);
+			else if(field=="MAXVAL")
+				header.max_value = netpbm_number(in);
+			else if(field=="TUPLTYPE")
+				tuple_type = netpbm_token(in);
+		}
+
+		if(header.channels==0)
+			header.channels = tuple_channels(tuple_type);
+	} else if(magic=="P5" || magic=="P6")
+	{
+		header.width = netpbm_number(in);
+		header.height = netpbm_number(in);
+		header.max_value = netpbm_number(in);
+		header.channels = magic=="P5" ? 1 : 3;
+	} else
+	{
+		throw std::runtime_error(std::string("unsupported netpbm type: ") + magic);
+	}
+
+	if(header.width==0 || header.height==0 || header.channels==0 || header.channels>4
+		|| header.max_value==0 || header.max_value>65535)
+	{
+		throw std::runtime_error("broken netpbm header");
+	}
+
+	return header;
+}
+
+bool stream::read_image(std::istream& in, yconv::image& img)
+{
+	in >> std::ws;
+	if(in.peek()==std::char_traits<char>::eof())
+		return false;
+
+	const trace::scope trace_scope("load");
+
+	if(in.peek()==0x89)
+	{
+		png::decoded_image decoded = png::read(in);
+		img = yconv::image(decoded.width, decoded.height, decoded.channels, std::move(decoded.data));
+
+		return true;
+	}
+
+	const netpbm_header header = read_netpbm_header(in);
+
+	const size_t samples = static_cast<size_t>(header.width)*header.height*header.channels;
+	const unsigned sample_size = header.max_value>255 ? 2 : 1;
+
+	std::vector<uint8_t> data(samples*sample_size);
+	if(!in.read(reinterpret_cast<char*>(data.data()), data.size()))
+		throw std::runtime_error("netpbm image ended early");
+
+	//everything gets scaled to 8 bits, 16 bit samples are big endian
+	if(sample_size==2 || header.max_value!=255)
+	{
+		for(size_t i = 0; i < samples; ++i)
+		{
+			const unsigned sample = sample_size==2 ? (data[i*2]<<8) | data[i*2+1] : data[i];
+			data[i] = std::min(sample, header.max_value)*255/header.max_value;
+		}
+
+		data.resize(samples);
+	}
+
+	img = yconv::image(header.width, header.height, header.channels, std::move(data));
+
+	return true;
+}
+
+void stream::write_netpbm(std::ostream& out, const yconv::image& img, const bool pam)
+{
+	const trace::scope trace_scope("save");
+
+	if(pam)
+	{
+		const char* tuple_types[] = {"GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA"};
+
+		out << "P7\nWIDTH " << img.width << "\nHEIGHT " << img.height << "\nDEPTH " << img.bpp
+			<< "\nMAXVAL 255\nTUPLTYPE " << tuple_types[img.bpp-1] << "\nENDHDR\n";
+
+		out.write(reinterpret_cast<const char*>(img.data.data()), img.data.size());
+	} else
+	{
+		out << "P6\n" << img.width << ' ' << img.height << "\n255\n";
+
+		if(img.bpp==3)
+		{
+			out.write(reinterpret_cast<const char*>(img.data.data()), img.data.size());
+		} else
+		{
+			std::vector<uint8_t> rgb(static_cast<size_t>(img.width)*img.height*3);
+			for(size_t i = 0; i < static_cast<size_t>(img.width)*img.height; ++i)
+			{
+				for(int c = 0; c < 3; ++c)
+					rgb[i*3+c] = img.data[i*img.bpp+(img.bpp<3 ? 0 : c)];
+			}
+
+			out.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+		}
+	}
+}
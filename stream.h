@@ -0,0 +1,32 @@
+#ifndef YAN_STREAM_H
+#define YAN_STREAM_H
+
+#include <istream>
+#include <ostream>
+
+#include <yanconv.h>
+
+
+//images read from and written to streams (like stdin and stdout) instead of files
+namespace stream
+{
+	struct netpbm_header
+	{
+		unsigned width = 0;
+		unsigned height = 0;
+		unsigned channels = 0;
+		unsigned max_value = 255;
+	};
+
+	//reads a ppm (P6), pgm (P5) or pam (P7) header including its magic, in is left at the pixels
+	netpbm_header read_netpbm_header(std::istream& in);
+
+	//reads the next image of a stream of ppm, pgm, pam or png images, they can follow each other
+	//without anything in between, returns false if the stream ended instead
+	bool read_image(std::istream& in, yconv::image& img);
+
+	//ppm if pam is false (dropping alpha), otherwise pam
+	void write_netpbm(std::ostream& out, const yconv::image& img, const bool pam);
+};
+
+#endif
@@ -132,4 +132,24 @@ std::string converter::convert(const yconv::image image, const replace_pairs pai
 	}
 
 	return converted_text;
+}
+
+index_tokens converter::index_table(const std::vector<color> colors, const replace_pairs pairs)
+{
+	index_tokens tokens;
+	tokens.reserve(colors.size());
+
+	for(const auto& c : colors)
+	{
+		const auto found = pairs.find(c);
+		if(found==pairs.end())
+		{
+			throw std::runtime_error(std::string("no text for color: ")
+				+ std::to_string(c.r) + ", " + std::to_string(c.g) + ", " + std::to_string(c.b));
+		}
+
+		tokens.push_back(found->second);
+	}
+
+	return tokens;
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <string>
 #include <filesystem>
 #include <map>
+#include <vector>
 
 #include <yanconv.h>
 
@@ -19,6 +20,7 @@ namespace totext
 	};
 
 	typedef std::map<color, std::string> replace_pairs;
+	typedef std::vector<std::string> index_tokens;
 	class parser
 	{
 	public:
@@ -30,6 +32,9 @@ namespace totext
 	{
 	public:
 		static std::string convert(const yconv::image image, const replace_pairs pairs);
+
+		//text for each palette index, so already dithered indices dont need a lookup per pixel
+		static index_tokens index_table(const std::vector<color> colors, const replace_pairs pairs);
 	};
 };
 
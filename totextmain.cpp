@@ -4,14 +4,16 @@
 #include <unistd.h>
 
 #include "totext.h"
+#include "stream.h"
 
 void help_message(const char* exec_path)
 {
-	std::cout << "usage: " << exec_path << " [args] /path/to/image\n\n";
+	std::cout << "usage: " << exec_path << " [args] /path/to/image\n";
+	std::cout << "       " << exec_path << " [args] - (reads ppm, pgm, pam or png images from stdin)\n\n";
 	std::cout << "args:\n";
 	std::cout << "	-c		color replace config (color=text format, separated by new lines)\n";
 	std::cout << "	-C		path to color replace config (color=text format, separated by new lines)\n";
-	std::cout << "	-o		output path (default ./image_name.txt)\n";
+	std::cout << "	-o		output path (default ./image_name.txt), - writes to stdout which is the default for stdin\n";
 	std::cout << "\n\ncolor replace example:\n";
 	std::cout << "	255,255,255=white\n";
 	std::cout << "	{255, 255, 255}=white";
@@ -75,6 +77,8 @@ int main(int argc, char* argv[])
 	std::string save_path;
 	if(argument_output_path!="")
 		save_path = argument_output_path;
+	else if(image_path=="-")
+		save_path = "-";
 	else
 		save_path = image_path.stem().string() + ".txt";
 
@@ -85,12 +89,27 @@ int main(int argc, char* argv[])
 		parser::parse_pairs(argument_colors)
 		: parser::parse_pairs(std::filesystem::path(argument_colors_path));
 
-	yconv::image img{image_path};
-	img.bpp_resize(3);
-	const std::string out_string = converter::convert(img, pairs);
+	std::ofstream out_file;
+	if(save_path!="-")
+		out_file.open(save_path);
 
-	std::ofstream out_text(save_path);
-	out_text << out_string;
+	std::ostream& out_text = save_path=="-" ? std::cout : out_file;
+
+	if(image_path=="-")
+	{
+		//every image gets converted as soon as it arrives, each ending with a new line
+		yconv::image img;
+		while(stream::read_image(std::cin, img))
+		{
+			img.bpp_resize(3);
+			out_text << converter::convert(img, pairs) << std::endl;
+		}
+	} else
+	{
+		yconv::image img{image_path};
+		img.bpp_resize(3);
+		out_text << converter::convert(img, pairs);
+	}
 
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <stdexcept>
+
+#include "trace.h"
+
+
+std::atomic<bool> trace::recording = false;
+
+namespace
+{
+	struct event
+	{
+		const char* name;
+		int64_t start;
+		int64_t duration;
+	};
+
+	struct thread_buffer
+	{
+		unsigned id;
+		std::vector<event> events;
+	};
+
+	const auto trace_start = std::chrono::steady_clock::now();
+
+	std::mutex buffers_mutex;
+	std::vector<std::unique_ptr<thread_buffer>> buffers;
+
+	int64_t now() noexcept
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now()-trace_start).count();
+	}
+
+	//buffers outlive their threads so short lived workers still show up in the trace
+	thread_buffer& local_buffer()
+	{
+		thread_local thread_buffer* buffer = nullptr;
+
+		if(buffer==nullptr)
+		{
+			std::lock_guard lock(buffers_mutex);
+
+			buffers.push_back(std::make_unique<thread_buffer>());
+			buffer = buffers.back().get();
+			buffer->id = buffers.size();
+		}
+
+		return *buffer;
+	}
+
+	std::string escaped(const char* text)
+	{
+		std::string out = "";
+		for(; *text!='\0'; ++text)
+		{
+			if(*text=='"' || *text=='\\')
+				out += '\\';
+
+			out += *text;
+		}
+
+		return out;
+	}
+}
+
+void trace::enable() noexcept
+{
+	recording = true;
+}
+
+void trace::save(const std::filesystem::path path)
+{
+	std::ofstream out(path);
+	if(!out)
+		throw std::runtime_error(std::string("cant open file for writing: ") + path.string());
+
+	std::lock_guard lock(buffers_mutex);
+
+	out << "{\"traceEvents\":[\n";
+
+	bool first = true;
+	for(const auto& buffer : buffers)
+	{
+		out << (first ? "" : ",\n");
+		out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->id
+			<< ",\"args\":{\"name\":\"thread " << buffer->id << "\"}}";
+		first = false;
+
+		for(const auto& e : buffer->events)
+		{
+			out << ",\n{\"name\":\"" << escaped(e.name) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->id
+				<< ",\"ts\":" << e.start << ",\"dur\":" << e.duration << "}";
+		}
+	}
+
+	out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+trace::scope::scope(const char* name) noexcept
+: _name(name)
+{
+	if(enabled())
+		_start = now();
+}
+
+trace::scope::~scope()
+{
+	if(_start<0)
+		return;
+
+	local_buffer().events.push_back(event{_name, _start, now()-_start});
+}
@@ -0,0 +1,41 @@
+#ifndef YAN_TRACE_H
+#define YAN_TRACE_H
+
+#include <filesystem>
+#include <atomic>
+#include <cstdint>
+
+
+//chrome/perfetto trace event recording, every thread appends to its own buffer
+//so recording doesnt lock, and a disabled recorder costs one relaxed load per scope
+namespace trace
+{
+	extern std::atomic<bool> recording;
+
+	void enable() noexcept;
+
+	inline bool enabled() noexcept
+	{
+		return recording.load(std::memory_order_relaxed);
+	}
+
+	//must only be called once the traced threads are done
+	void save(const std::filesystem::path path);
+
+	//records the time between its construction and destruction, name must outlive the trace
+	class scope
+	{
+	public:
+		scope(const char* name) noexcept;
+		~scope();
+
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+
+	private:
+		const char* _name;
+		int64_t _start = -1;
+	};
+};
+
+#endif